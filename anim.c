@@ -1,176 +1,245 @@
 #include <allegro5/allegro.h>
 #include <stdio.h>
+#include <string.h>
 #include "anim.h"
+#include "resource.h"
 
 
-#define ANIM_MAX_FRAMES 8
+#define MAX_CLIPS 32
+#define CLIP_MAX_FRAMES 16
+#define CLIP_NAME_SIZE 32
+#define CLIP_FILENAME_SIZE 256
 
 
 static float animator_fps = 60; /* A default value of 60 frame per second */
 
 
-struct ANIM {
-    ALLEGRO_BITMAP *frames[ANIM_MAX_FRAMES];
+struct CLIP {
+    char name[CLIP_NAME_SIZE];
+    ALLEGRO_BITMAP *image;      /* The image the frames are cut out of */
+
+    /* Sub-bitmaps of the image, so they change when it's reloaded */
+    ALLEGRO_BITMAP *frames[CLIP_MAX_FRAMES];
     int size;                   /* Number of frames */
-    int pos;                    /* The current frame number */
-    float fudge;
 
     float speed;                /* In frames per second */
     int loop;                   /* Set true to loop forever */
-    int done;                   /* Is true if finished animating */
-
-    int w;
-    int h;
 };
 
 
+static CLIP clips[MAX_CLIPS];
+static int num_clips = 0;
+
+
 void init_animator(float fps)
 {
     animator_fps = fps;
 }
 
 
-ANIM *create_anim(int loop, float speed)
+/**
+ * Internal function.
+ * Cut a frame out of the clip's image.
+ */
+static int add_clip_frame(CLIP *clip, int x, int y, int w, int h)
 {
-    ANIM *anim;
-    int i;
+  /**
+   * Don't add the frame if there's no more room.
+   */
+    if (clip->size >= CLIP_MAX_FRAMES) {
+        fprintf(stderr, "ANIM: Failed to add frame to clip \"%s\".\n", clip->name);
+        fprintf(stderr, "Please increase CLIP_MAX_FRAMES.\n");
+        return 0;
+    }
 
-    anim = malloc(sizeof(ANIM));
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 ||
+        x + w > al_get_bitmap_width(clip->image) ||
+        y + h > al_get_bitmap_height(clip->image)) {
+        fprintf(stderr, "ANIM: Frame %d of clip \"%s\" is outside the image.\n",
+                clip->size, clip->name);
+        return 0;
+    }
 
-    if (anim != NULL) {
-        for (i = 0; i < ANIM_MAX_FRAMES; i++) {
-            anim->frames[i] = NULL;
-        }
-        anim->size = 0;
-        anim->pos = 0;
-        anim->fudge = 0;
-        anim->speed = speed / animator_fps;
-        anim->loop = loop;
-        anim->done = 1;
+    clip->frames[clip->size] = al_create_sub_bitmap(clip->image, x, y, w, h);
+
+    if (clip->frames[clip->size] == NULL) {
+        return 0;
     }
 
-    return anim;
+    clip->size++;
+
+    return 1;
 }
 
 
-ANIM *add_frame(ANIM * anim, ALLEGRO_BITMAP * frame)
+/**
+ * Internal function.
+ * Finish a clip. A clip without frames is the whole image.
+ */
+static void finish_clip(CLIP *clip)
 {
-    if (anim == NULL || frame == NULL) {
-        return anim;
+    if (clip->size == 0) {
+        add_clip_frame(clip, 0, 0, al_get_bitmap_width(clip->image),
+                       al_get_bitmap_height(clip->image));
     }
+}
 
-  /**
-   * Don't add the frame if there's no more room.
-   */
-    if (anim->size >= ANIM_MAX_FRAMES - 1) {
-        fprintf(stderr, "ANIM: Failed to add frame to animation.\n");
-        fprintf(stderr, "Please increase ANIM_MAX_FRAMES.\n");
+
+int load_clips(const char *filename)
+{
+    FILE *file;
+    CLIP *clip = NULL;
+    char word[CLIP_FILENAME_SIZE];
+    char image[CLIP_FILENAME_SIZE];
+    int x, y, w, h;
+    int count = 0;
+
+    file = open_resource_stream(filename);
+
+    if (file == NULL) {
+        fprintf(stderr, "ANIM: Failed to open clips \"%s\".\n", filename);
+        return -1;
     }
 
-    anim->frames[anim->size] = frame;
-    anim->size++;
+    while (fscanf(file, "%255s", word) == 1) {
 
-  /**
-   * Set the width and height to the size of
-   * the first frame.
-   */
-    if (anim->size == 1) {
-        anim->w = al_get_bitmap_width(frame);
-        anim->h = al_get_bitmap_height(frame);
-    }
+        /* Skip comments */
+        if (word[0] == '#') {
+            fscanf(file, "%*[^\n]");
+            continue;
+        }
 
-    anim->pos = 0;
-    anim->fudge = 0;
-    anim->done = 0;
+        if (strcmp(word, "CLIP") == 0) {
+            if (clip != NULL) {
+                finish_clip(clip);
+                clip = NULL;
+            }
 
-    return anim;
-}
+            if (num_clips >= MAX_CLIPS) {
+                fprintf(stderr, "ANIM: Failed to add clip.\n");
+                fprintf(stderr, "Please increase MAX_CLIPS.\n");
+                break;
+            }
 
+            clip = &clips[num_clips];
+            clip->size = 0;
 
-ANIM *destroy_frames(ANIM * anim)
-{
-    int i;
+            if (fscanf(file, "%31s %255s %d %f", clip->name, image,
+                       &clip->loop, &clip->speed) != 4) {
+                fprintf(stderr, "ANIM: Failed to load clip in \"%s\".\n", filename);
+                clip = NULL;
+                break;
+            }
+
+            clip->image = acquire_resource_image(image);
+
+            if (clip->image == NULL) {
+                fprintf(stderr, "ANIM: Failed to load image of clip \"%s\".\n", clip->name);
+                clip = NULL;
+                continue;
+            }
+
+            num_clips++;
+            count++;
+
+        } else if (strcmp(word, "FRAME") == 0) {
+            if (fscanf(file, "%d %d %d %d", &x, &y, &w, &h) != 4) {
+                fprintf(stderr, "ANIM: Failed to load frame in \"%s\".\n", filename);
+                break;
+            }
 
-    if (anim != NULL) {
-        for (i = 0; i < anim->size; i++) {
-            free(anim->frames[i]);
+            /* Frames of a clip that failed to load are skipped */
+            if (clip != NULL) {
+                add_clip_frame(clip, x, y, w, h);
+            }
+
+        } else {
+            fprintf(stderr, "ANIM: Unknown word \"%s\" in \"%s\".\n", word, filename);
+            break;
         }
-        anim->size = 0;
     }
 
-    anim->pos = 0;
-    anim->fudge = 0;
-    anim->done = 1;
+    if (clip != NULL) {
+        finish_clip(clip);
+    }
 
-    return anim;
+    fclose(file);
+
+    return count;
 }
 
 
-void destroy_anim(ANIM * anim)
+void destroy_clips()
 {
-    free(anim);
-}
+    int i;
+    int j;
 
+    for (i = 0; i < num_clips; i++) {
 
-void reset_anim(ANIM *anim)
-{
-    if (anim != NULL) {
-        anim->pos = 0;
-        anim->fudge = 0;
-        anim->done = 0;
+        /* Sub-bitmaps have to be destroyed before their image */
+        for (j = 0; j < clips[i].size; j++) {
+            al_destroy_bitmap(clips[i].frames[j]);
+        }
+
+        release_resource_image(clips[i].image);
     }
+
+    num_clips = 0;
 }
 
 
-void animate(ANIM * anim)
+CLIP *find_clip(const char *name)
 {
-    if (anim == NULL) {
-        return;
-    }
+    int i;
 
-    if (anim->done) {
-        return;
+    for (i = 0; i < num_clips; i++) {
+        if (strcmp(clips[i].name, name) == 0) {
+            return &clips[i];
+        }
     }
 
-  /**
-   * Every time you "animate", add the speed
-   * to the fudge.
-   */
-    anim->fudge += anim->speed;
+    fprintf(stderr, "ANIM: Failed to find clip \"%s\".\n", name);
 
-  /**
-   * When the fudge is greater than one, it's
-   * time to go to the next frame.
-   */
-    while (anim->fudge > 1 && !anim->done) {
+    return NULL;
+}
 
-        anim->pos++;
 
-        if (anim->pos >= anim->size) {
-            if (anim->loop) {
-                anim->pos = 0;
-            } else {
-                anim->done = 1;
-            }
-        }
+void play_anim(ANIM *anim, CLIP *clip, unsigned long tick)
+{
+    anim->clip = clip;
+    anim->start = tick;
+}
 
-        anim->fudge -= 1;
+
+/**
+ * Internal function.
+ * The number of frames that have gone by since the
+ * animation started, without looping.
+ */
+static unsigned long frames_played(ANIM *anim, unsigned long tick)
+{
+    if (tick <= anim->start) {
+        return 0;
     }
+
+    return (unsigned long)((tick - anim->start) * (double)anim->clip->speed / animator_fps);
 }
 
 
-void draw_anim(ANIM * anim, float x, float y, int flags)
+void draw_anim(ANIM * anim, unsigned long tick, float x, float y, int flags)
 {
-    if (anim) {
-        al_draw_bitmap(anim->frames[anim->pos], x, y, 0);
+    ALLEGRO_BITMAP *frame = anim_frame(anim, tick);
+
+    if (frame) {
+        al_draw_bitmap(frame, x, y, flags);
     }
 }
 
 
 int anim_width(ANIM * anim)
 {
-    if (anim != NULL) {
-        return anim->w;
+    if (anim != NULL && anim->clip != NULL && anim->clip->size > 0) {
+        return al_get_bitmap_width(anim->clip->frames[0]);
     }
 
     return 0;
@@ -179,18 +248,18 @@ int anim_width(ANIM * anim)
 
 int anim_height(ANIM * anim)
 {
-    if (anim != NULL) {
-        return anim->h;
+    if (anim != NULL && anim->clip != NULL && anim->clip->size > 0) {
+        return al_get_bitmap_height(anim->clip->frames[0]);
     }
 
     return 0;
 }
 
 
-int anim_done(ANIM * anim)
+int anim_done(ANIM * anim, unsigned long tick)
 {
-    if (anim != NULL) {
-        return anim->done;
+    if (anim != NULL && anim->clip != NULL) {
+        return !anim->clip->loop && frames_played(anim, tick) >= (unsigned long)anim->clip->size;
     }
 
   /**
@@ -199,11 +268,26 @@ int anim_done(ANIM * anim)
     return 1;
 }
 
-ALLEGRO_BITMAP *current_frame(ANIM * anim)
+
+ALLEGRO_BITMAP *anim_frame(ANIM * anim, unsigned long tick)
 {
-    if (anim != NULL) {
-        return anim->frames[anim->pos];
+    unsigned long pos;
+
+    if (anim == NULL || anim->clip == NULL || anim->clip->size == 0) {
+        return NULL;
     }
 
-    return NULL;
+    pos = frames_played(anim, tick);
+
+  /**
+   * Loop back to the start, or stay on the
+   * last frame once it's done.
+   */
+    if (anim->clip->loop) {
+        pos %= anim->clip->size;
+    } else if (pos >= (unsigned long)anim->clip->size) {
+        pos = anim->clip->size - 1;
+    }
+
+    return anim->clip->frames[pos];
 }
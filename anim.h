@@ -2,57 +2,71 @@
 #define ANIM_H
 
 
-typedef struct ANIM ANIM;
-
-
 /**
- * Send the frames per second that the game is running at.
+ * A clip is an animation cut out of one image, such as a
+ * sprite sheet. Clips are loaded once from a clips file and
+ * shared by everything that plays them.
  */
-void init_animator(float fps);
+typedef struct CLIP CLIP;
+
 
 /**
- * Create an empty animation. Set loop to true to loop
- * the animation. The speed is in frames per second.
- * Set the fps parameter to the number of frames per
- * second the game is running at.
+ * A clip being played. This is small enough to keep inside
+ * every sprite, and doesn't need to be freed.
+ *
+ * An animation doesn't change as the game updates. The frame
+ * is worked out from the tick it started on and the tick it's
+ * drawn on, so there's nothing to do until it's drawn.
  */
-ANIM *create_anim(int loop, float speed);
+typedef struct ANIM {
+    CLIP *clip;                 /* NULL if nothing is playing */
+    unsigned long start;        /* The tick it started playing on */
+} ANIM;
+
 
 /**
- * Add a frame to the animation. Returns a pointer
- * to the same animation.
+ * Send the frames per second that the game is running at.
  */
-ANIM *add_frame(ANIM * anim, ALLEGRO_BITMAP * frame);
+void init_animator(float fps);
 
 /**
- * Remove all frames from the animation and free
- * the memory. Returns a pointer to the same
- * animation.
+ * Load the clips in a clips file, which looks like this:
+ *
+ *   # name     image     loop  speed
+ *   CLIP bee   bee.bmp   1     15
+ *   # x  y  w  h
+ *   FRAME 0  0  20 20
+ *   FRAME 20 0  20 20
+ *
+ * The speed is in frames per second. A clip without frames
+ * is the whole image. Lines starting with "#" are comments.
+ * Images are found with the resource library (see resource.h).
+ * Returns the number of clips, or -1 on failure.
  */
-ANIM *destroy_frames(ANIM * anim);
+int load_clips(const char *filename);
 
 /**
- * Free the memory of the animation. This will not free
- * the memory of the frames.
+ * Free every clip and let go of their images.
  */
-void destroy_anim(ANIM * anim);
+void destroy_clips();
 
 /**
- * Reset the animation to its starting frame.
+ * Find a clip by its name. Returns NULL if there's no such clip.
  */
-void reset_anim(ANIM *anim);
+CLIP *find_clip(const char *name);
 
 /**
- * Animate!
+ * Start playing a clip from its first frame on a tick.
+ * A tick is one game update.
  */
-void animate(ANIM * anim);
+void play_anim(ANIM *anim, CLIP *clip, unsigned long tick);
 
 /**
- * Draw the animation to the current target bitmap.
- * For information on the target bitmap and the flags,
- * please see the Allegro documentation.
+ * Draw the animation as it is on a tick to the current
+ * target bitmap. For information on the target bitmap
+ * and the flags, please see the Allegro documentation.
  */
-void draw_anim(ANIM * anim, float x, float y, int flags);
+void draw_anim(ANIM * anim, unsigned long tick, float x, float y, int flags);
 
 /**
  * Animation width. This is the width of the
@@ -68,15 +82,15 @@ int anim_height(ANIM * anim);
 
 /**
  * Returns true if the animation is at the
- * end of the last fram. An animation that
- * loops will always return false.
+ * end of the last fram on a tick. An animation
+ * that loops will always return false.
  */
-int anim_done(ANIM * anim);
+int anim_done(ANIM * anim, unsigned long tick);
 
 /**
- * Get the current frame.
+ * Get the frame that is showing on a tick.
  */
-ALLEGRO_BITMAP *current_frame(ANIM * anim);
+ALLEGRO_BITMAP *anim_frame(ANIM * anim, unsigned long tick);
 
 
 #endif
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_memfile.h>
+
+#include "archive.h"
+
+
+static const unsigned char *archive = NULL; /* The whole archive, in memory */
+static long archive_size = 0;
+static int num_archive_files = 0;
+
+
+/**
+ * Internal function.
+ * Read a little endian number out of the archive.
+ */
+static long read32(const unsigned char *p)
+{
+    return (long)p[0] | ((long)p[1] << 8) | ((long)p[2] << 16) | ((long)p[3] << 24);
+}
+
+
+/**
+ * Internal function.
+ */
+static const unsigned char *archive_entry(int i)
+{
+    return archive + ARCHIVE_HEADER_SIZE + i * ARCHIVE_ENTRY_SIZE;
+}
+
+
+int open_archive(const char *filename)
+{
+    struct stat info;
+    void *data;
+    long offset;
+    long size;
+    int fd;
+    int i;
+
+    close_archive();
+
+    fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    if (fstat(fd, &info) != 0 || info.st_size < ARCHIVE_HEADER_SIZE) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays after the file is closed */
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ARCHIVE: Failed to map \"%s\".\n", filename);
+        return 0;
+    }
+
+    archive = data;
+    archive_size = info.st_size;
+
+    if (memcmp(archive, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "ARCHIVE: \"%s\" isn't an archive.\n", filename);
+        close_archive();
+        return 0;
+    }
+
+    num_archive_files = read32(archive + ARCHIVE_MAGIC_SIZE);
+
+  /**
+   * Make sure the directory and every file fit in the
+   * archive, so nothing has to be checked later.
+   */
+    if (num_archive_files < 0 ||
+        ARCHIVE_HEADER_SIZE + (long)num_archive_files * ARCHIVE_ENTRY_SIZE > archive_size) {
+        fprintf(stderr, "ARCHIVE: \"%s\" is damaged.\n", filename);
+        close_archive();
+        return 0;
+    }
+
+    for (i = 0; i < num_archive_files; i++) {
+        offset = read32(archive_entry(i) + ARCHIVE_NAME_SIZE);
+        size = read32(archive_entry(i) + ARCHIVE_NAME_SIZE + 4);
+
+        if (offset < 0 || size < 0 || offset + size > archive_size) {
+            fprintf(stderr, "ARCHIVE: \"%s\" is damaged.\n", filename);
+            close_archive();
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+void close_archive()
+{
+    if (archive != NULL) {
+        munmap((void *)archive, archive_size);
+    }
+
+    archive = NULL;
+    archive_size = 0;
+    num_archive_files = 0;
+}
+
+
+const void *archive_data(const char *name, long *size)
+{
+    const unsigned char *entry;
+    int low = 0;
+    int high = num_archive_files - 1;
+    int middle;
+    int compare;
+
+  /**
+   * The directory is sorted, so use a binary search.
+   */
+    while (low <= high) {
+        middle = (low + high) / 2;
+        entry = archive_entry(middle);
+
+        compare = strncmp(name, (const char *)entry, ARCHIVE_NAME_SIZE);
+
+        if (compare == 0) {
+            *size = read32(entry + ARCHIVE_NAME_SIZE + 4);
+            return archive + read32(entry + ARCHIVE_NAME_SIZE);
+        } else if (compare < 0) {
+            high = middle - 1;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+ALLEGRO_FILE *open_archive_file(const char *name)
+{
+    const void *data;
+    long size;
+
+    data = archive_data(name, &size);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    /* The memory file is only read from, so it won't write to the archive */
+    return al_open_memfile((void *)data, size, "r");
+}
+
+
+int count_archive_files()
+{
+    return num_archive_files;
+}
+
+
+void archive_file_name(int i, char *dest, int size)
+{
+    int length = 0;
+
+    /* The names are padded with zeros */
+    while (length < ARCHIVE_NAME_SIZE && length < size - 1 && archive_entry(i)[length] != '\0') {
+        dest[length] = archive_entry(i)[length];
+        length++;
+    }
+
+    dest[length] = '\0';
+}
@@ -0,0 +1,73 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+
+#include <allegro5/allegro.h>
+
+
+/**
+ * An archive holds all of the game's files in one big file,
+ * so they can be opened with one call and read straight out
+ * of memory. Archives are made with the "pack" tool.
+ *
+ * The archive starts with ARCHIVE_MAGIC and the number of
+ * files, followed by a directory entry for each file, sorted
+ * by name. Each entry is the name, padded with zeros to
+ * ARCHIVE_NAME_SIZE bytes, then the offset of the file from
+ * the start of the archive and its size. All of the numbers
+ * are 32 bit little endian.
+ */
+#define ARCHIVE_MAGIC "BPAK"
+#define ARCHIVE_MAGIC_SIZE 4
+#define ARCHIVE_HEADER_SIZE 8
+
+#define ARCHIVE_NAME_SIZE 56
+#define ARCHIVE_ENTRY_SIZE 64
+
+/* Files in the archive start on a multiple of this */
+#define ARCHIVE_ALIGNMENT 16
+
+
+/**
+ * Open an archive. The archive is mapped into memory, and the
+ * files are only read from the disk when they are used.
+ * Only one archive can be open at a time.
+ * Returns false if the archive can't be opened.
+ */
+int open_archive(const char *filename);
+
+/**
+ * Close the archive. Anything read out of the
+ * archive can't be used anymore.
+ */
+void close_archive();
+
+/**
+ * Find a file in the archive, such as "images/bee1.bmp".
+ * Returns a pointer to the contents of the file and sets
+ * the size, or returns NULL if the file isn't in the archive.
+ * The contents are read only.
+ */
+const void *archive_data(const char *name, long *size);
+
+/**
+ * Open a file in the archive as an Allegro file.
+ * Returns NULL if the file isn't in the archive.
+ */
+ALLEGRO_FILE *open_archive_file(const char *name);
+
+/**
+ * Get the number of files in the archive, or 0 if
+ * there isn't an archive open.
+ */
+int count_archive_files();
+
+/**
+ * Get the name of a file in the archive by its number,
+ * from 0 to count_archive_files() - 1. The files are
+ * sorted by name.
+ */
+void archive_file_name(int i, char *dest, int size);
+
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Bake images so the game can load them without decoding
+ * them or turning magic pink into transparency.
+ *
+ *   bake-tool images/bee.bmp images/hole.bmp ...
+ *
+ * Or run "make bake" to bake every image that changed. Each
+ * baked image is saved next to the original, with the extension
+ * changed to ".bake". The game skips a baked image that is older
+ * than the original.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_image.h>
+
+#include "baked.h"
+
+
+#define MAX_FILENAME_SIZE 256
+
+
+int bake(const char *filename)
+{
+    ALLEGRO_BITMAP *bitmap;
+    char baked[MAX_FILENAME_SIZE];
+
+    bitmap = al_load_bitmap(filename);
+
+    if (bitmap == NULL) {
+        fprintf(stderr, "Failed to load image \"%s\".\n", filename);
+        return 0;
+    }
+
+    al_convert_mask_to_alpha(bitmap, al_map_rgb(255, 0, 255));
+
+    baked_filename(baked, filename, MAX_FILENAME_SIZE);
+
+    if (!save_baked_bitmap(baked, bitmap)) {
+        fprintf(stderr, "Failed to save baked image \"%s\".\n", baked);
+        al_destroy_bitmap(bitmap);
+        return 0;
+    }
+
+    printf("%s -> %s\n", filename, baked);
+
+    al_destroy_bitmap(bitmap);
+
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s IMAGE...\n", argv[0]);
+        return 1;
+    }
+
+    if (!al_init() || !al_init_image_addon()) {
+        fprintf(stderr, "Failed to initialize allegro.\n");
+        return 1;
+    }
+
+    /* There's no display */
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+    for (i = 1; i < argc; i++) {
+        if (!bake(argv[i])) {
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "baked.h"
+
+
+/* Bytes per pixel */
+#define BAKED_PIXEL_SIZE 4
+
+/* Don't trust images bigger than this */
+#define MAX_BAKED_SIZE 8192
+
+
+ALLEGRO_BITMAP *load_baked_bitmap_f(ALLEGRO_FILE *file)
+{
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_LOCKED_REGION *region;
+    char magic[BAKED_MAGIC_SIZE];
+    size_t row_size;
+    int w;
+    int h;
+    int y;
+
+    if (al_fread(file, magic, BAKED_MAGIC_SIZE) != BAKED_MAGIC_SIZE ||
+        memcmp(magic, BAKED_MAGIC, BAKED_MAGIC_SIZE) != 0) {
+        return NULL;
+    }
+
+    w = al_fread32le(file);
+    h = al_fread32le(file);
+
+    if (w <= 0 || h <= 0 || w > MAX_BAKED_SIZE || h > MAX_BAKED_SIZE) {
+        return NULL;
+    }
+
+    bitmap = al_create_bitmap(w, h);
+
+    if (bitmap == NULL) {
+        return NULL;
+    }
+
+  /**
+   * Read the pixels straight into the bitmap, one row
+   * at a time since the rows might have padding.
+   */
+    region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+                            ALLEGRO_LOCK_WRITEONLY);
+
+    if (region == NULL) {
+        al_destroy_bitmap(bitmap);
+        return NULL;
+    }
+
+    row_size = w * BAKED_PIXEL_SIZE;
+
+    for (y = 0; y < h; y++) {
+        if (al_fread(file, (char *)region->data + y * region->pitch, row_size) != row_size) {
+            al_unlock_bitmap(bitmap);
+            al_destroy_bitmap(bitmap);
+            return NULL;
+        }
+    }
+
+    al_unlock_bitmap(bitmap);
+
+    return bitmap;
+}
+
+
+ALLEGRO_BITMAP *load_baked_bitmap(const char *filename)
+{
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_FILE *file;
+
+    file = al_fopen(filename, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    bitmap = load_baked_bitmap_f(file);
+
+    al_fclose(file);
+
+    return bitmap;
+}
+
+
+int save_baked_bitmap(const char *filename, ALLEGRO_BITMAP *bitmap)
+{
+    ALLEGRO_LOCKED_REGION *region;
+    ALLEGRO_FILE *file;
+    size_t row_size;
+    int ok = 1;
+    int w = al_get_bitmap_width(bitmap);
+    int h = al_get_bitmap_height(bitmap);
+    int y;
+
+    file = al_fopen(filename, "wb");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+                            ALLEGRO_LOCK_READONLY);
+
+    if (region == NULL) {
+        al_fclose(file);
+        return 0;
+    }
+
+    al_fwrite(file, BAKED_MAGIC, BAKED_MAGIC_SIZE);
+    al_fwrite32le(file, w);
+    al_fwrite32le(file, h);
+
+    row_size = w * BAKED_PIXEL_SIZE;
+
+    for (y = 0; y < h && ok; y++) {
+        if (al_fwrite(file, (char *)region->data + y * region->pitch, row_size) != row_size) {
+            ok = 0;
+        }
+    }
+
+    al_unlock_bitmap(bitmap);
+
+    if (!al_fclose(file)) {
+        ok = 0;
+    }
+
+    return ok;
+}
+
+
+void baked_filename(char *dest, const char *filename, int size)
+{
+    const char *dot;
+    int length;
+
+    dot = strrchr(filename, '.');
+
+    /* A dot in a directory name isn't an extension */
+    if (dot == NULL || strchr(dot, '/') != NULL) {
+        length = strlen(filename);
+    } else {
+        length = dot - filename;
+    }
+
+    if (length > size - (int)strlen(BAKED_EXTENSION) - 1) {
+        length = size - strlen(BAKED_EXTENSION) - 1;
+    }
+
+    strncpy(dest, filename, length);
+    dest[length] = '\0';
+    strcat(dest, BAKED_EXTENSION);
+}
@@ -0,0 +1,50 @@
+#ifndef BAKED_H
+#define BAKED_H
+
+
+#include <allegro5/allegro.h>
+
+
+/**
+ * A baked image is an image that's ready to be copied
+ * straight into a bitmap, without decoding it or turning
+ * magic pink into transparency. Baked images are made
+ * ahead of time with the "bake" tool.
+ *
+ * The file starts with BAKED_MAGIC, then the width and
+ * height as 32 bit little endian numbers, then the pixels
+ * one row at a time as red, green, blue and alpha bytes.
+ * The colors are already multiplied by the alpha.
+ */
+#define BAKED_MAGIC "BAKE"
+#define BAKED_MAGIC_SIZE 4
+
+/* Baked files are named after the image, with this extension */
+#define BAKED_EXTENSION ".bake"
+
+
+/**
+ * Load a baked image from an open file.
+ * Returns NULL if the file isn't a baked image.
+ */
+ALLEGRO_BITMAP *load_baked_bitmap_f(ALLEGRO_FILE *file);
+
+/**
+ * Load a baked image. Returns NULL if the file
+ * doesn't exist or isn't a baked image.
+ */
+ALLEGRO_BITMAP *load_baked_bitmap(const char *filename);
+
+/**
+ * Save a bitmap as a baked image. Returns false on failure.
+ */
+int save_baked_bitmap(const char *filename, ALLEGRO_BITMAP *bitmap);
+
+/**
+ * Make the baked filename of an image, by replacing its
+ * extension with BAKED_EXTENSION.
+ */
+void baked_filename(char *dest, const char *filename, int size);
+
+
+#endif
@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_acodec.h>
 #include <allegro5/allegro_audio.h>
@@ -8,19 +10,31 @@
 #include <allegro5/allegro_ttf.h>
 
 #include "anim.h"
+#include "archive.h"
+#include "blocks.h"
+#include "governor.h"
 #include "input.h"
+#include "level.h"
 #include "memory.h"
 #include "physics.h"
 #include "random.h"
 #include "resource.h"
+#include "snapshot.h"
+#include "sound.h"
+#include "thumbs.h"
+#include "watch.h"
+#include "workers.h"
 
 
 #define MAX_PADDLES 10
 #define MAX_BALLS 20
-#define MAX_HOLES 20
+#define MAX_BALL_HITS 64 /* Blocks a ball can hit in one update, even in hyper mode */
+#define BALL_BATCHES 4 /* Groups of balls that are moved at the same time */
+#define MIN_PARALLEL_BALLS 4 /* With fewer balls, the game thread moves them all */
+#define MAX_FIELD_SEED 32767 /* Seeds of the random numbers of fields and balls */
+#define MAX_HOLES MAX_LEVEL_HOLES /* Every hole in a level has to fit */
 #define MAX_POWERUPS 20
 
-#define PERCENT_POWERUPS_APPEAR 10
 #define MAX_POWERUP_BOUNCES 4 /* Hits to the field border before disappearing */
 #define LONG_POWERUP_EFFECT_TIME 20 /* In seconds */
 #define MEDIUM_POWERUP_EFFECT_TIME 8 /* In seconds */
@@ -34,14 +48,178 @@
 
 #define MILLIS_PER_SECOND 1000
 
+#define ARCHIVE_FILENAME "beeball.pak" /* Made with "make pack" */
+#define PRELOAD_MANIFEST "data/preload.txt" /* Images every level uses */
+#define CLIPS_FILENAME "data/clips.txt" /* Animations shared by the sprites */
+#define BLOCK_TYPES_FILENAME "data/blocks.txt"
+#define MUSIC_FILENAME "sounds/music.ogg"
+#define MUSIC_GAIN 0.5 /* Keep the music behind the sound effects */
+
+#define MAX_LEVELS 1024
+#define LEVELS_DIRECTORY "data/"
+#define LEVEL_EXTENSION ".dat"
+
+#define SELECT_COLUMNS 4 /* Thumbnails across the level select screen */
+#define SELECT_ROWS 3
+#define SELECT_SPACING 24 /* Pixels between the thumbnails */
+#define SELECT_KEEP_ROWS 2 /* Rows of thumbnails kept loaded above and below the screen */
+#define MAX_SHOWN_THUMBS ((SELECT_COLUMNS) * (SELECT_ROWS))
+
+#define SLOW_HOLE_ANIM_RATE 3 /* Change the hole frames every few updates */
+
+#define MAX_BLOCK_HITS 255
+#define BOARD_BITS 32 /* Cells in each word of an occupancy row */
+#define MIN_BLASTS 16 /* Room in the queue of blasts to start with */
+#define BALL_BLAST_RADIUS 1 /* The blocks touching the one a blast ball hits */
+#define BALL_BLAST_SHAPE BLAST_DIAMOND
+#define MAX_MAP_TYPES MAX_LEVEL_BLOCK_IDS /* Block types a map can use */
+
+#define PADDLE_SHADOW_OFFSET 4 /* Paddle shadows don't bounce */
+#define MIN_BALL_SHADOW_OFFSET 4
+#define MAX_BALL_SHADOW_OFFSET 16
+#define BALL_SHADOW_SPEED 0.4 /* Pixels per update */
+#define SHADOW_OPACITY 1.0 /* 0 is invisible, 1 is solid */
+#define SHADOW_MARGIN 32 /* Room around the shadow layer for offset shadows */
+
+#define CAMERA_FOLLOW 0.1 /* How much of the way to the balls the camera moves each update */
+
+#define ENDLESS_WIDTH 32 /* Blocks across an endless map, as wide as the canvas */
+#define CHUNK_ROWS 24 /* Rows of blocks in each chunk of an endless map */
+#define MAX_CHUNKS 4 /* Chunks of an endless map kept at once */
+#define ENDLESS_SCROLL_SPEED 0.25 /* Pixels per update */
+#define ENDLESS_PADDLE_MARGIN 20 /* From the paddle to the bottom of the screen */
+#define ENDLESS_START_ROWS 8 /* Empty rows at the bottom of the first chunk */
+
+#define BENCHMARK_SEED 2011 /* Benchmarks and tests always play the same game */
+#define DEFAULT_BENCHMARK_FRAMES 1000
+#define DEFAULT_PARSE_BENCHMARK_RUNS 10
+#define GOLDEN_FRAMES 200 /* The frame to compare against the golden image */
+#define GOLDEN_TOLERANCE 8 /* Allowed difference in each color channel */
+#define GOLDEN_MAX_BAD_PIXELS 50 /* Pixels allowed to be outside the tolerance */
+
 
 const float FPS = 100;
+const float MENU_FPS = 20; /* Menus handle keys right away, so they can tick slower */
 const int CANVAS_W = 640;
 const int CANVAS_H = 480;
 const int BLOCK_SIZE = 20;
 
 
 ALLEGRO_DISPLAY *display = NULL;
+ALLEGRO_TIMER *timer = NULL;
+ALLEGRO_TIMER *menu_timer = NULL;
+
+/* Hands snapshots of the game over to the render thread */
+SNAPSHOTS *snapshots = NULL;
+
+/* The levels, in the order they are played (see find_levels) */
+char level_filenames[MAX_LEVELS][STRING_LENGTH];
+int num_levels = 0;
+
+/**
+ * The layers that a frame is drawn in, for timing.
+ */
+typedef enum LAYER {
+    LAYER_WALLPAPER = 0,
+    LAYER_BACKGROUND,
+    LAYER_SHADOWS,
+    LAYER_HOLES,
+    LAYER_MAP,
+    LAYER_PADDLES,
+    LAYER_POWERUPS,
+    LAYER_BALLS,
+    LAYER_BORDER,
+    LAYER_CANVAS,
+    NUM_LAYERS
+} LAYER;
+
+
+const char *layer_names[NUM_LAYERS] = {
+    "wallpaper",
+    "background",
+    "shadows",
+    "holes",
+    "map",
+    "paddles",
+    "powerups",
+    "balls",
+    "border",
+    "canvas"
+};
+
+
+/* Set to true to time how long each layer takes to draw */
+int profile_layers = 0;
+
+double layer_times[NUM_LAYERS]; /* In seconds */
+double layer_start = 0;
+
+
+void start_layer()
+{
+    if (profile_layers) {
+        layer_start = al_get_time();
+    }
+}
+
+
+void end_layer(LAYER layer)
+{
+    if (profile_layers) {
+        layer_times[layer] += al_get_time() - layer_start;
+    }
+}
+
+
+/* Set when something visible changed and the screen needs to be redrawn */
+int redraw_requested = 1;
+
+/* The game is paused and the timer is stopped */
+int paused = 0;
+
+/* Load levels and images again when their files change (--dev) */
+int dev_mode = 0;
+
+
+void request_redraw()
+{
+    redraw_requested = 1;
+}
+
+
+/**
+ * Stop the timer, so nothing is updated or drawn until
+ * the game is resumed.
+ */
+void pause_game()
+{
+    if (!paused) {
+        paused = 1;
+        al_stop_timer(timer);
+        request_redraw();
+    }
+}
+
+
+void resume_game()
+{
+    if (paused) {
+        paused = 0;
+        al_start_timer(timer);
+        request_redraw();
+    }
+}
+
+
+/**
+ * The sounds in the sound bank (see sound.h).
+ */
+typedef enum GAME_SOUND {
+    SOUND_BLOCK_HIT = 0,
+    SOUND_PADDLE_HIT,
+    SOUND_POWERUP_COLLECTED,
+    NUM_GAME_SOUNDS
+} GAME_SOUND;
 
 
 typedef enum DIRECTION {
@@ -68,13 +246,14 @@ typedef struct RECT {
 } RECT;
 
 
-typedef enum BLOCK_TYPE {
-    BLOCK_EMPTY = 0,
-    BLOCK_DAISY,
-    BLOCK_ROSE,
-    BLOCK_FERN,
-    NUM_BLOCK_TYPES
-} BLOCK_TYPE;
+/* The blocks of maps that aren't made from a level */
+#define NUM_ENDLESS_BLOCKS 3
+
+const char *endless_block_images[NUM_ENDLESS_BLOCKS] = {
+    "block-daisy.bmp",
+    "block-rose.bmp",
+    "block-fern.bmp"
+};
 
 
 typedef struct BODY {
@@ -88,7 +267,7 @@ typedef struct BODY {
 
 typedef struct PADDLE {
     BODY body;
-    ANIM *anim;
+    ANIM anim;
     ALLEGRO_BITMAP *shadow;
     char orientation; /* 'H' for horizontal, 'V' for vertical */
 } PADDLE;
@@ -96,9 +275,9 @@ typedef struct PADDLE {
 
 typedef struct HOLE {
     BODY body;
-    ANIM *anim;
-    ANIM *normal_anim;
-    ANIM *chomp_anim;
+    ANIM anim;
+    CLIP *normal_clip;
+    CLIP *chomp_clip;
 } HOLE;
 
 
@@ -112,20 +291,41 @@ typedef enum POWERUP_TYPE {
 } POWERUP_TYPE;
 
 
+/* The names of the powerups, for the drop tables of block types */
+const char *powerup_names[NUM_POWERUP_TYPES] = {
+    "none",
+    "drill",
+    "scatter",
+    "hyper",
+    "blast"
+};
+
+
 typedef struct POWERUP {
     BODY body;
     POWERUP_TYPE type;
-    ANIM *anim;
+    ANIM anim;
     float effect_timer;
     int bounces;
 } POWERUP;
 
 
+/**
+ * A block that a ball hit while moving. The map doesn't change
+ * while the balls move, so the hits are kept until they're done.
+ */
+typedef struct BALL_HIT {
+    int x;
+    int y;
+    int radius; /* Of the blast around the block */
+} BALL_HIT;
+
+
 typedef struct BALL {
     BODY body;
     int speed;
     
-    ANIM *anim;
+    ANIM anim;
     ALLEGRO_BITMAP *shadow;
     float facing; /* The bee randomly rotates as he hits stuff */
     int paddlehit; /* Is true when the ball has been hit by a paddle */
@@ -133,23 +333,108 @@ typedef struct BALL {
     
     POWERUP_TYPE powerup_type;
     float powerup_timer;
+    
+    /* Balls can be moved by any thread, so each has its own random numbers */
+    RANDOM random;
+    
+    /* What happened while the ball moved, for the game thread to apply */
+    BALL_HIT hits[MAX_BALL_HITS];
+    int num_hits;
+    int sounds; /* One bit for each GAME_SOUND */
 } BALL;
 
 
+/**
+ * A cell of the map. Everything else about the block is looked
+ * up in the table of block types (see blocks.h), so a cell is
+ * only two bytes.
+ */
 typedef struct BLOCK {
-    ALLEGRO_BITMAP *bitmap;
-    int hits;
+    unsigned char type; /* NO_BLOCK_TYPE if there isn't a block */
+    unsigned char hits;
 } BLOCK;
 
 
+/**
+ * An area of the map to damage, waiting in the queue of blasts.
+ */
+typedef struct BLAST {
+    int x;
+    int y;
+    int radius; /* In blocks, 0 for only the middle */
+    BLAST_SHAPE shape;
+} BLAST;
+
+
 typedef struct MAP {
     int width; /* The width in blocks */
     int height; /* The height in blocks */
     BLOCK *blocks;
-    int num_blocks; /* The number of blocks (not including spaces) */
+    int num_blocks; /* The number of blocks that can still be hit */
+    
+    /**
+     * One bit for every block that can still be hit, row by row,
+     * so finding out if a cell is solid doesn't touch the blocks.
+     */
+    unsigned long *board;
+    int board_width; /* Words in each row */
+    
+    /* The blocks already hit by the blast going off, laid out like the board */
+    unsigned long *blasted;
+    
+    BLAST *blasts; /* The queue of blasts still to go off */
+    int max_blasts;
+    
+    /* The block types the map uses, let go of when it's destroyed */
+    int types[MAX_MAP_TYPES];
+    int num_types;
 } MAP;
 
 
+/**
+ * A piece of an endless map, made by a worker thread.
+ */
+typedef struct CHUNK {
+    unsigned long number; /* Chunks are numbered from the bottom of the map */
+    unsigned long seed;
+    
+    /* The block type and hits of every cell, row by row */
+    unsigned char types[CHUNK_ROWS * ENDLESS_WIDTH];
+    unsigned char hits[CHUNK_ROWS * ENDLESS_WIDTH];
+    
+    int palette[NUM_ENDLESS_BLOCKS]; /* The block types to make it out of */
+    
+    int done;
+    ALLEGRO_MUTEX *mutex;
+} CHUNK;
+
+
+/**
+ * A map that keeps going. The map holds MAX_CHUNKS chunks,
+ * and as the screen scrolls up, the bottom chunk is thrown out
+ * and the next one is put on top.
+ */
+typedef struct ENDLESS {
+    unsigned long seed;
+    unsigned long next_chunk; /* The number of the next chunk to make */
+    CHUNK *pending; /* The chunk being made by a worker, NULL if none */
+    JOB_GROUP jobs; /* Holds the job making the pending chunk */
+    int types[NUM_ENDLESS_BLOCKS]; /* The block types the chunks are made of */
+} ENDLESS;
+
+
+/**
+ * Some of the balls of a field, moved together by one thread.
+ */
+typedef struct BALL_BATCH {
+    struct FIELD *field;
+    int first; /* The first of the field's moving balls */
+    int count;
+    int claimed; /* Is true once a thread started moving the balls */
+    int done;
+} BALL_BATCH;
+
+
 typedef struct FIELD {
     char description[STRING_LENGTH];
     
@@ -163,10 +448,34 @@ typedef struct FIELD {
     
     BALL *balls[MAX_BALLS];
     
+    /* Seeds the balls, so the field plays the same on any thread */
+    RANDOM random;
+    
+    /* The balls are split into batches, so the workers can move them */
+    BALL_BATCH batches[BALL_BATCHES];
+    BALL *moving[MAX_BALLS]; /* The balls in slot order, split evenly into the batches */
+    int ball_jobs; /* Jobs that haven't finished, even if they had nothing to do */
+    ALLEGRO_MUTEX *ball_mutex;
+    ALLEGRO_COND *ball_cond;
+    
     POWERUP *powerups[MAX_POWERUPS];
 
     ALLEGRO_EVENT_QUEUE *events;
     
+    /* The ball shadows "bounce" to look like the balls are flying */
+    float shadow_offset;
+    int shadow_increase;
+    
+    unsigned long tick; /* Updates since the field was loaded, for animations */
+    
+    /* The top left of the part of the field on the screen, in pixels */
+    float camera_x;
+    float camera_y;
+    
+    ENDLESS *endless; /* NULL if the map doesn't go on forever */
+    
+    int powerup_percent; /* Destroyed blocks that drop a powerup */
+    
     /* Default values for new balls in this field */
     float default_ball_x;
     float default_ball_y;
@@ -180,14 +489,148 @@ typedef struct PLAYER {
 } PLAYER;
 
 
+/**
+ * A level that is being loaded by a worker thread.
+ */
+typedef struct LEVEL_LOAD {
+    char filename[STRING_LENGTH];
+    unsigned long seed; /* Picked on the game thread, see build_field */
+    FIELD *field; /* NULL if the level failed to load */
+    
+    /* Called on the game thread when the level is done loading */
+    void (*ready)(struct LEVEL_LOAD *load, void *data);
+    void *data;
+    
+    int done;
+    int reported; /* Is true if ready has been called */
+    ALLEGRO_MUTEX *mutex;
+    ALLEGRO_COND *cond;
+    
+    JOB_GROUP jobs; /* Holds the job loading the level */
+} LEVEL_LOAD;
+
+
 typedef struct GAME {
     PLAYER *player;
     FIELD *field;
     
+    int level; /* The number of the level being played */
+    
+    /* The level after this one, loaded while this one is played */
+    LEVEL_LOAD *next_level;
+    FIELD *next_field;
+    
     float mousescale; /* Scale the mouse position to match the screen */
 } GAME;
 
 
+typedef enum THUMB_STATE {
+    THUMB_UNLOADED = 0,
+    THUMB_LOADING,
+    THUMB_LOADED
+} THUMB_STATE;
+
+
+/**
+ * The thumbnail of a level on the level select screen.
+ * Thumbnails are loaded by worker threads as they come
+ * close to the screen, and let go of when they're far away.
+ */
+typedef struct LEVEL_THUMB {
+    int level; /* The number of the level */
+    THUMB_STATE state;
+    ALLEGRO_BITMAP *bitmap; /* Acquired, or NULL if it failed to load */
+    int shown; /* Is true once it was drawn after loading */
+    
+    /* Goes up when the level file changes, with the mutex locked */
+    unsigned long generation;
+    
+    /* Set by the worker when it's done loading, with the mutex locked */
+    int done;
+    unsigned long loaded; /* The generation the worker loaded */
+    ALLEGRO_MUTEX *mutex;
+} LEVEL_THUMB;
+
+
+typedef struct LEVEL_SELECT {
+    LEVEL_THUMB thumbs[MAX_LEVELS];
+    ALLEGRO_MUTEX *mutex;
+    
+    int selected; /* The number of the selected level */
+    int top_row; /* The first row of thumbnails on the screen */
+    
+    /* The selected level, loaded while the player looks at it */
+    LEVEL_LOAD *load;
+    int load_level;
+    
+    JOB_GROUP thumb_jobs;
+} LEVEL_SELECT;
+
+
+/**
+ * Something to draw, centered on a position.
+ */
+typedef struct SPRITE {
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_BITMAP *shadow; /* NULL if it doesn't have a shadow */
+    float x;
+    float y;
+    float angle; /* In radians */
+} SPRITE;
+
+
+/**
+ * Everything the render thread needs to draw one frame.
+ * The game fills in a snapshot after updating, so the render
+ * thread never has to look at the game while it's changing.
+ */
+typedef struct SNAPSHOT {
+    void (*draw)(struct SNAPSHOT *snapshot);
+    int paused;
+    
+    /* The size of the map, in blocks */
+    int map_width;
+    int map_height;
+    
+    RECT view; /* The part of the field on the screen, in pixels */
+    
+    SPRITE paddles[MAX_PADDLES];
+    int num_paddles;
+    
+    SPRITE holes[MAX_HOLES];
+    int num_holes;
+    
+    SPRITE powerups[MAX_POWERUPS];
+    int num_powerups;
+    
+    SPRITE balls[MAX_BALLS];
+    int num_balls;
+    
+    float shadow_offset; /* How far the ball shadows are from the balls */
+    
+    /**
+     * The blocks in the visible part of the map, in rows, starting
+     * with the block at cells_x, cells_y. Only these are copied, so
+     * a snapshot costs the same no matter how big the map is.
+     */
+    int cells_x;
+    int cells_y;
+    int cells_w;
+    int cells_h;
+    ALLEGRO_BITMAP **cells; /* NULL where there's no block */
+    int cells_size;
+    
+    /* The thumbnails on the level select screen, NULL if they're still loading */
+    ALLEGRO_BITMAP *thumbs[MAX_SHOWN_THUMBS];
+    int num_thumbs;
+    int selected_thumb; /* -1 if the selected level isn't on the screen */
+    
+    /* The blocks behind the title, picked with the seed */
+    ALLEGRO_BITMAP *title_blocks[NUM_ENDLESS_BLOCKS];
+    unsigned long title_seed;
+} SNAPSHOT;
+
+
 int north_edge(float y, BOX *box)
 {
     return y - box->u;
@@ -248,6 +691,87 @@ int field_height(FIELD *field)
 }
 
 
+/**
+ * Get the part of the field that is on the screen, in pixels.
+ * Fields bigger than the canvas only show the part around the camera.
+ */
+void field_view(FIELD *field, RECT *view)
+{
+    view->w = field_width(field) < CANVAS_W ? field_width(field) : CANVAS_W;
+    view->h = field_height(field) < CANVAS_H ? field_height(field) : CANVAS_H;
+    view->x = field->camera_x;
+    view->y = field->camera_y;
+}
+
+
+/**
+ * Move the camera toward the middle of the balls. Follow is how
+ * much of the way it moves, so 1 puts it there right away.
+ * Returns true if the camera moved.
+ */
+int update_camera(FIELD *field, float follow)
+{
+    RECT view;
+    float x = 0;
+    float y = 0;
+    float old_x = field->camera_x;
+    float old_y = field->camera_y;
+    int num_balls = 0;
+    int i = 0;
+    
+    for (i = 0; i < MAX_BALLS; i++) {
+        if (field->balls[i]) {
+            x += field->balls[i]->body.x;
+            y += field->balls[i]->body.y;
+            num_balls++;
+        }
+    }
+    
+    /* Stay put when there's nothing to follow, endless maps scroll on their own */
+    if (num_balls == 0 || field->endless) {
+        return 0;
+    }
+    
+    field_view(field, &view);
+    
+    x = (x / num_balls) - (view.w / 2);
+    y = (y / num_balls) - (view.h / 2);
+    
+    field->camera_x += (x - field->camera_x) * follow;
+    field->camera_y += (y - field->camera_y) * follow;
+    
+    /* Don't show anything past the edges of the field */
+    if (field->camera_x > field_width(field) - view.w) {
+        field->camera_x = field_width(field) - view.w;
+    }
+    if (field->camera_y > field_height(field) - view.h) {
+        field->camera_y = field_height(field) - view.h;
+    }
+    if (field->camera_x < 0) {
+        field->camera_x = 0;
+    }
+    if (field->camera_y < 0) {
+        field->camera_y = 0;
+    }
+    
+    return (int)field->camera_x != (int)old_x || (int)field->camera_y != (int)old_y;
+}
+
+
+/**
+ * The tick the holes are drawn at. When the game is running
+ * slow, the holes only change frames every few updates.
+ */
+unsigned long hole_tick(FIELD *field)
+{
+    if (get_quality() >= QUALITY_SLOW_HOLES) {
+        return field->tick - field->tick % SLOW_HOLE_ANIM_RATE;
+    }
+    
+    return field->tick;
+}
+
+
 float seconds_to_millis(int seconds)
 {
     return seconds * MILLIS_PER_SECOND;
@@ -326,20 +850,18 @@ POWERUP *create_powerup(int x, int y, POWERUP_TYPE type)
     /* After 4 bounces the powerup leaves the screen */
     powerup->bounces = 0;
     
-    powerup->anim = create_anim(0, 0);
-    
     if (type == POWERUP_BLAST) {
         powerup->effect_timer = seconds_to_millis(LONG_POWERUP_EFFECT_TIME);
-        add_frame(powerup->anim, load_resource_image("powerup-blast.bmp"));
+        play_anim(&powerup->anim, find_clip("powerup-blast"), 0);
     } else if (type == POWERUP_DRILL) {
         powerup->effect_timer = seconds_to_millis(MEDIUM_POWERUP_EFFECT_TIME);
-        add_frame(powerup->anim, load_resource_image("powerup-drill.bmp"));
+        play_anim(&powerup->anim, find_clip("powerup-drill"), 0);
     } else if (type == POWERUP_HYPER) {
         powerup->effect_timer = seconds_to_millis(SHORT_POWERUP_EFFECT_TIME);
-        add_frame(powerup->anim, load_resource_image("powerup-hyper.bmp"));
+        play_anim(&powerup->anim, find_clip("powerup-hyper"), 0);
     } else if (type == POWERUP_SCATTER) {
         powerup->effect_timer = seconds_to_millis(LONG_POWERUP_EFFECT_TIME);
-        add_frame(powerup->anim, load_resource_image("powerup-scatter.bmp"));
+        play_anim(&powerup->anim, find_clip("powerup-scatter"), 0);
     } else {
         fprintf(stderr, "WARNING: Unknown powerup type %d\n", type);
         destroy_powerup(powerup);
@@ -467,8 +989,6 @@ void update_powerup(POWERUP *powerup, FIELD *field)
         return;
     }
     
-    animate(powerup->anim);
-    
     newx = accelerate(powerup->body.x, powerup->body.velx);
     newy = accelerate(powerup->body.y, powerup->body.vely);
     
@@ -531,22 +1051,6 @@ void update_powerup(POWERUP *powerup, FIELD *field)
 }
 
 
-void draw_powerup(POWERUP *powerup)
-{
-    int x = 0;
-    int y = 0;
-    
-    if (!powerup) {
-        return;
-    }
-    
-    x = powerup->body.x - (anim_width(powerup->anim) / 2);
-    y = powerup->body.y - (anim_height(powerup->anim) / 2);
-
-    draw_anim(powerup->anim, x, y, 0);
-}
-
-
 /**
  * Orientation is either H for horizontal or V for vertical.
  */
@@ -560,14 +1064,12 @@ PADDLE *create_paddle(int x, int y, char orientation)
     paddle->body.y = y;
     paddle->orientation = orientation;
 
-    paddle->anim = create_anim(0, 0);
-
     if (paddle->orientation == 'H') {
-        add_frame(paddle->anim, load_resource_image("hpaddle.bmp"));
-        paddle->shadow = load_resource_image("hpaddle-shadow.bmp");
+        play_anim(&paddle->anim, find_clip("hpaddle"), 0);
+        paddle->shadow = acquire_resource_image("hpaddle-shadow.bmp");
     } else {
-        add_frame(paddle->anim, load_resource_image("vpaddle.bmp"));
-        paddle->shadow = load_resource_image("vpaddle-shadow.bmp");
+        play_anim(&paddle->anim, find_clip("vpaddle"), 0);
+        paddle->shadow = acquire_resource_image("vpaddle-shadow.bmp");
     }
     
     if (paddle->orientation == 'H') {
@@ -589,7 +1091,7 @@ PADDLE *create_paddle(int x, int y, char orientation)
 void destroy_paddle(PADDLE * paddle)
 {
     if (paddle) {
-        destroy_anim(paddle->anim);
+        release_resource_image(paddle->shadow);
     }
 
     free_memory("PADDLE", paddle);
@@ -663,12 +1165,17 @@ int box_collision(int x1, int y1, BOX *box, int x2, int y2)
 
 void update_paddle_with_mouse(PADDLE *paddle, GAME *game, ALLEGRO_EVENT *event)
 {
+    RECT view;
+    int x = 0;
+    int y = 0;
+    
     /**
      * Use these offsets to make the paddle match up
      * with the actual mouse pointer.
      */
-    int x = (CANVAS_W - field_width(game->field)) / 2;
-    int y = (CANVAS_H - field_height(game->field)) / 2;
+    field_view(game->field, &view);
+    x = ((CANVAS_W - view.w) / 2) - view.x;
+    y = ((CANVAS_H - view.h) / 2) - view.y;
     
     /* Update mouse input */
     if (event->type == ALLEGRO_EVENT_MOUSE_AXES) {
@@ -718,36 +1225,15 @@ void update_paddle_with_keyboard(PADDLE *paddle, FIELD *field)
 }
 
 
-void draw_paddle(PADDLE *paddle)
-{
-    int x = 0;
-    int y = 0;
-    
-    if (!paddle) {
-        return;
-    }
-    
-    x = paddle->body.x - (anim_width(paddle->anim) / 2);
-    y = paddle->body.y - (anim_height(paddle->anim) / 2);
-
-    draw_anim(paddle->anim, x, y, 0);
-}
-
-
 HOLE *create_hole(float x, float y)
 {
     HOLE *hole = alloc_memory("HOLE", sizeof(HOLE));
     
-    hole->normal_anim = create_anim(0, 0);
-    add_frame(hole->normal_anim, load_resource_image("hole1.bmp"));
-    
-    hole->chomp_anim = create_anim(1, 8);
-    add_frame(hole->chomp_anim, load_resource_image("hole2.bmp"));
-    add_frame(hole->chomp_anim, load_resource_image("hole3.bmp"));
-    add_frame(hole->chomp_anim, load_resource_image("hole1.bmp"));
+    hole->normal_clip = find_clip("hole");
+    hole->chomp_clip = find_clip("hole-chomp");
     
     /* Set the default animation */
-    hole->anim = hole->normal_anim;
+    play_anim(&hole->anim, hole->normal_clip, 0);
     
     hole->body.x = x;
     hole->body.y = y;
@@ -765,11 +1251,6 @@ HOLE *create_hole(float x, float y)
 
 void destroy_hole(HOLE *hole)
 {
-    if (hole) {
-        destroy_anim(hole->normal_anim);
-        destroy_anim(hole->chomp_anim);
-    }
-    
     free_memory("HOLE", hole);
 }
 
@@ -824,12 +1305,11 @@ void update_hole(HOLE *hole, FIELD *field)
         if (distance_between(&(hole->body), &(field->balls[i]->body)) < dist) {
             
             /* Start chomping! */
-            if (hole->anim != hole->chomp_anim) {
-                hole->anim = hole->chomp_anim;
-                reset_anim(hole->anim);
+            if (hole->anim.clip != hole->chomp_clip) {
+                play_anim(&hole->anim, hole->chomp_clip, field->tick);
             }
-        } else {
-            hole->anim = hole->normal_anim;
+        } else if (hole->anim.clip != hole->normal_clip) {
+            play_anim(&hole->anim, hole->normal_clip, field->tick);
         }
         
         /**
@@ -841,48 +1321,34 @@ void update_hole(HOLE *hole, FIELD *field)
             field->balls[i]->dead = 1;
         }
     }
-    
-    animate(hole->anim);
-}
-
-
-void draw_hole(HOLE *hole)
-{
-    int x = 0;
-    int y = 0;
-
-    x = hole->body.x - (anim_width(hole->anim) / 2);
-    y = hole->body.y - (anim_height(hole->anim) / 2);
-
-    draw_anim(hole->anim, x, y, 0);
 }
 
 
 MAP *create_map(int width, int height)
 {
     MAP *map = NULL;
-    BLOCK *block = NULL;
-    
-    int x = 0;
-    int y = 0;
     
     map = alloc_memory("MAP", sizeof(MAP));
     
     map->width = width;
     map->height = height;
 
+    /* All zeros is a map without any blocks */
     map->blocks = calloc_memory("GRID", width * height, sizeof(BLOCK));
     assert(map->blocks);
     
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            block = &(map->blocks[(y * map->width) + x]);
-            block->bitmap = NULL;
-            block->hits = 0;
-        }
-    }
+    map->board_width = (width + BOARD_BITS - 1) / BOARD_BITS;
+    map->board = calloc_memory("BOARD", map->board_width * height, sizeof(unsigned long));
+    assert(map->board);
+    
+    map->blasted = calloc_memory("BLASTED", map->board_width * height, sizeof(unsigned long));
+    assert(map->blasted);
+    
+    map->blasts = alloc_memory("BLASTS", MIN_BLASTS * sizeof(BLAST));
+    map->max_blasts = MIN_BLASTS;
     
     map->num_blocks = 0;
+    map->num_types = 0;
     
     return map;
 }
@@ -890,51 +1356,137 @@ MAP *create_map(int width, int height)
 
 void destroy_map(MAP * map)
 {
+    int i = 0;
+    
     if (map) {
+        for (i = 0; i < map->num_types; i++) {
+            release_block_type(map->types[i]);
+        }
+        
         free_memory("BLOCKS", map->blocks);
+        free_memory("BOARD", map->board);
+        free_memory("BLASTED", map->blasted);
+        free_memory("BLASTS", map->blasts);
     }
 
     free_memory("MAP", map);
 }
 
 
-void set_block_bitmap(MAP * map, int x, int y, ALLEGRO_BITMAP *bitmap)
+/**
+ * Get the block type of an image for a map, see add_block_type.
+ * The map holds on to the type until it's destroyed.
+ */
+int use_block_type(MAP *map, const char *filename)
 {
-    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
-        return;
+    int type = NO_BLOCK_TYPE;
+    
+    if (map->num_types >= MAX_MAP_TYPES) {
+        fprintf(stderr, "Failed to add block type \"%s\" to the map.\n", filename);
+        return NO_BLOCK_TYPE;
     }
     
-    map->blocks[(y * map->width) + x].bitmap = bitmap;
-}
-
-
-void set_block_hits(MAP * map, int x, int y, int hits)
-{
-    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
-        return;
+    type = add_block_type(filename);
+    
+    if (type != NO_BLOCK_TYPE) {
+        map->types[map->num_types++] = type;
     }
     
-    map->blocks[(y * map->width) + x].hits = hits;
+    return type;
 }
 
 
-int get_block_hits(MAP * map, int x, int y)
+/**
+ * Mark a cell as solid or not on the occupancy board.
+ */
+void set_board_bit(MAP *map, int x, int y, int solid)
 {
-    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
-        return 0;
-    }
+    unsigned long *word = &(map->board[(y * map->board_width) + (x / BOARD_BITS)]);
+    unsigned long bit = 1UL << (x % BOARD_BITS);
     
-    return map->blocks[(y * map->width) + x].hits;
+    if (solid) {
+        *word |= bit;
+    } else {
+        *word &= ~bit;
+    }
 }
 
 
-void add_powerup(FIELD *field, POWERUP *powerup)
+/**
+ * Put a block of a type (see blocks.h) on the map.
+ */
+void set_block(MAP * map, int x, int y, int type, int hits)
 {
-    int i = 0;
+    BLOCK *block = NULL;
     
-    for (i = 0; i < MAX_POWERUPS; i++) {
-        if (field->powerups[i] == NULL) {
-            field->powerups[i] = powerup;
+    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
+        return;
+    }
+    
+    if (hits > MAX_BLOCK_HITS) {
+        hits = MAX_BLOCK_HITS;
+    }
+    
+    if (hits < 0) {
+        hits = 0;
+    }
+    
+    block = &(map->blocks[(y * map->width) + x]);
+    
+    if (block->hits > 0) {
+        map->num_blocks--;
+    }
+    
+    block->type = type;
+    block->hits = type == NO_BLOCK_TYPE ? 0 : hits;
+    
+    if (block->hits > 0) {
+        map->num_blocks++;
+    }
+    
+    set_board_bit(map, x, y, block->hits > 0);
+}
+
+
+int get_block_hits(MAP * map, int x, int y)
+{
+    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
+        return 0;
+    }
+    
+    return map->blocks[(y * map->width) + x].hits;
+}
+
+
+/**
+ * Check if there's a block that can be hit at a cell.
+ */
+int is_block_solid(MAP *map, int x, int y)
+{
+    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
+        return 0;
+    }
+    
+    return (map->board[(y * map->board_width) + (x / BOARD_BITS)] >> (x % BOARD_BITS)) & 1;
+}
+
+
+/**
+ * Check if every block on the map has been destroyed.
+ */
+int is_map_clear(MAP *map)
+{
+    return map->num_blocks <= 0;
+}
+
+
+void add_powerup(FIELD *field, POWERUP *powerup)
+{
+    int i = 0;
+    
+    for (i = 0; i < MAX_POWERUPS; i++) {
+        if (field->powerups[i] == NULL) {
+            field->powerups[i] = powerup;
             return;
         }
     }
@@ -943,13 +1495,41 @@ void add_powerup(FIELD *field, POWERUP *powerup)
 }
 
 
-void drop_a_powerup(FIELD *field, int x, int y)
+POWERUP_TYPE find_powerup_type(const char *name)
+{
+    int i = 0;
+    
+    for (i = POWERUP_NONE + 1; i < NUM_POWERUP_TYPES; i++) {
+        if (strcmp(powerup_names[i], name) == 0) {
+            return i;
+        }
+    }
+    
+    return POWERUP_NONE;
+}
+
+
+/**
+ * Drop a powerup out of the drop table of a block type.
+ */
+void drop_a_powerup(FIELD *field, int x, int y, BLOCK_TYPE *block_type)
 {
     int actualx = (x * BLOCK_SIZE) + (BLOCK_SIZE / 2);
     int actualy = (y * BLOCK_SIZE) + (BLOCK_SIZE / 2);
+    const char *name = NULL;
     
     POWERUP_TYPE type = random_number(POWERUP_NONE + 1, NUM_POWERUP_TYPES - 1);
     
+    if (block_type->num_drops > 0) {
+        name = pick_block_drop(block_type, random_number(0, block_type->total_weight - 1));
+        type = find_powerup_type(name);
+    }
+    
+    if (type == POWERUP_NONE) {
+        fprintf(stderr, "WARNING: Unknown powerup \"%s\" in block type \"%s\".\n", name, block_type->name);
+        return;
+    }
+    
     add_powerup(field, create_powerup(actualx, actualy, type));
 }
 
@@ -960,72 +1540,173 @@ int random_percent(int percent)
 }
 
 
-void hit_block(FIELD *field, MAP *map, int x, int y, int destroy_touching)
+/**
+ * Take a hit off a block, and drop a powerup if it's destroyed.
+ * Returns the type of the block if it was destroyed, or NULL.
+ */
+BLOCK_TYPE *hit_block(FIELD *field, MAP *map, int x, int y)
 {
-    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
-        return;
+    BLOCK *block = NULL;
+    BLOCK_TYPE *type = NULL;
+    int percent = 0;
+    
+    /* There's no block here to hit */
+    if (!is_block_solid(map, x, y)) {
+        return NULL;
     }
     
-    map->blocks[(y * map->width) + x].hits--;
+    block = &(map->blocks[(y * map->width) + x]);
+    type = get_block_type(block->type);
     
-    /* Destroy the blocks that are touching this one */
-    if (destroy_touching) {
-        hit_block(field, map, x - 1, y, 0);
-        hit_block(field, map, x + 1, y, 0);
-        hit_block(field, map, x, y - 1, 0);
-        hit_block(field, map, x, y + 1, 0);
+    block->hits--;
+    
+    if (block->hits > 0) {
+        return NULL;
     }
     
-    /* Check to see if the block has any hits left */
-    if (map->blocks[(y * map->width) + x].hits <= 0) {
-        
-        /* Clear the block */
-        map->blocks[(y * map->width) + x].hits = 0;
-        map->blocks[(y * map->width) + x].bitmap = NULL;
-        map->num_blocks--;
-        
-        /**
-         * When a block is destroyed, randomly decide if
-         * you should create a power-up powerup.
-         */
-        if (random_percent(PERCENT_POWERUPS_APPEAR)) {
-            drop_a_powerup(field, x, y);
-        }
+    /* Clear the block */
+    block->hits = 0;
+    block->type = NO_BLOCK_TYPE;
+    map->num_blocks--;
+    set_board_bit(map, x, y, 0);
+    
+    /**
+     * When a block is destroyed, randomly decide if
+     * you should create a power-up powerup.
+     */
+    percent = type->powerup_percent == LEVEL_POWERUPS ? field->powerup_percent : type->powerup_percent;
+    
+    if (random_percent(percent)) {
+        drop_a_powerup(field, x, y, type);
     }
+    
+    return type;
 }
 
 
-BLOCK *get_block(MAP *map, int x, int y)
+/**
+ * Put a blast in the queue, making room if it's full.
+ */
+void queue_blast(MAP *map, int num_blasts, int x, int y, int radius, BLAST_SHAPE shape)
 {
-    if (x < 0 || y < 0 || x > map->width - 1 || y > map->height - 1) {
-        return NULL;
+    BLAST *blasts = NULL;
+    BLAST *blast = NULL;
+    
+    if (num_blasts >= map->max_blasts) {
+        blasts = alloc_memory("BLASTS", map->max_blasts * 2 * sizeof(BLAST));
+        assert(blasts);
+        memcpy(blasts, map->blasts, map->max_blasts * sizeof(BLAST));
+        free_memory("BLASTS", map->blasts);
+        
+        map->blasts = blasts;
+        map->max_blasts *= 2;
     }
     
-    return &(map->blocks[(y * map->width) + x]);
+    blast = &(map->blasts[num_blasts]);
+    blast->x = x;
+    blast->y = y;
+    blast->radius = radius;
+    blast->shape = shape;
 }
 
 
+/**
+ * Hit every block in an area once. Blocks with a blast of their
+ * own put it in the queue when they're destroyed, and it goes off
+ * after the blasts before it. Blocks that were already hit by any
+ * of the blasts are skipped, so a chain of blasts always ends, and
+ * it takes as long as the number of blocks it covers.
+ */
+void blast_area(FIELD *field, MAP *map, int x, int y, int radius, BLAST_SHAPE shape)
+{
+    BLAST *blast = NULL;
+    BLOCK_TYPE *destroyed = NULL;
+    unsigned long *word = NULL;
+    unsigned long bit = 0;
+    int num_blasts = 0;
+    int next = 0;
+    int bx = 0;
+    int by = 0;
+    
+    /* The part of the map that was hit, to clear afterwards */
+    int left = map->width;
+    int top = map->height;
+    int right = -1;
+    int bottom = -1;
+    
+    queue_blast(map, num_blasts++, x, y, radius, shape);
+    
+    for (next = 0; next < num_blasts; next++) {
+        blast = &(map->blasts[next]);
+        
+        for (by = blast->y - blast->radius; by <= blast->y + blast->radius; by++) {
+            for (bx = blast->x - blast->radius; bx <= blast->x + blast->radius; bx++) {
+                if (!is_in_blast(bx - blast->x, by - blast->y, blast->radius, blast->shape) ||
+                    !is_block_solid(map, bx, by)) {
+                    continue;
+                }
+                
+                word = &(map->blasted[(by * map->board_width) + (bx / BOARD_BITS)]);
+                bit = 1UL << (bx % BOARD_BITS);
+                
+                if (*word & bit) {
+                    continue;
+                }
+                
+                *word |= bit;
+                
+                left = bx < left ? bx : left;
+                right = bx > right ? bx : right;
+                top = by < top ? by : top;
+                bottom = by > bottom ? by : bottom;
+                
+                destroyed = hit_block(field, map, bx, by);
+                
+                if (destroyed && destroyed->blast > 0) {
+                    queue_blast(map, num_blasts++, bx, by, destroyed->blast, destroyed->blast_shape);
+                    
+                    /* The queue might have moved to make room */
+                    blast = &(map->blasts[next]);
+                }
+            }
+        }
+    }
+    
+    /* Clear the marks for the next blast */
+    for (by = top; by <= bottom; by++) {
+        for (bx = left / BOARD_BITS; bx <= right / BOARD_BITS; bx++) {
+            map->blasted[(by * map->board_width) + bx] = 0;
+        }
+    }
+}
+
 
-void draw_map(MAP * map)
+/**
+ * Draw the blocks that are inside the visible part of the field.
+ */
+void draw_map(SNAPSHOT *snapshot)
 {
     ALLEGRO_BITMAP *bitmap = NULL;
-    int hits = 0;
     int x = 0;
     int y = 0;
     
-    for (y = 0; y < map->height; y++) {
-        for (x = 0; x < map->width; x++) {
-            bitmap = map->blocks[(y * map->width) + x].bitmap;
-            hits = map->blocks[(y * map->width) + x].hits;
-            if (bitmap != NULL && hits > 0) {
-                al_draw_bitmap(bitmap, x * BLOCK_SIZE, y * BLOCK_SIZE, 0);
+    for (y = 0; y < snapshot->cells_h; y++) {
+        for (x = 0; x < snapshot->cells_w; x++) {
+            bitmap = snapshot->cells[(y * snapshot->cells_w) + x];
+            if (bitmap != NULL) {
+                al_draw_bitmap(bitmap, (snapshot->cells_x + x) * BLOCK_SIZE,
+                               (snapshot->cells_y + y) * BLOCK_SIZE, 0);
             }
         }
     }
 }
 
 
-BALL *create_ball(float x, float y, float angle)
+/**
+ * Create a ball. Its random numbers come from the seed, so
+ * pass a seed from the field's own random numbers.
+ */
+BALL *create_ball(float x, float y, float angle, unsigned long seed)
 {
     BALL *ball = NULL;
 
@@ -1043,11 +1724,9 @@ BALL *create_ball(float x, float y, float angle)
     
     ball->speed = BALL_SPEED;
     
-    ball->anim = create_anim(1, 15);
-    add_frame(ball->anim, load_resource_image("bee1.bmp"));
-    add_frame(ball->anim, load_resource_image("bee2.bmp"));
+    play_anim(&ball->anim, find_clip("bee"), 0);
     
-    ball->shadow = load_resource_image("bee-shadow.bmp");
+    ball->shadow = acquire_resource_image("bee-shadow.bmp");
     
     ball->facing = 0;
     ball->paddlehit = 0;
@@ -1056,6 +1735,11 @@ BALL *create_ball(float x, float y, float angle)
     
     ball->powerup_timer = 0;
     ball->powerup_type = POWERUP_NONE;
+    
+    seed_random_state(&ball->random, seed);
+    
+    ball->num_hits = 0;
+    ball->sounds = 0;
 
     return ball;
 }
@@ -1064,14 +1748,14 @@ BALL *create_ball(float x, float y, float angle)
 void destroy_ball(BALL * ball)
 {
     if (ball) {
-        destroy_anim(ball->anim);
+        release_resource_image(ball->shadow);
     }
     
     free_memory("BALL", ball);
 }
 
 
-float random_direction()
+float random_direction(RANDOM *random)
 {
     static float flags[4] = {
         0, /* 0 degrees */
@@ -1080,7 +1764,7 @@ float random_direction()
         (ALLEGRO_PI / 2) * 3 /* 270 degrees */
     };
 
-    return flags[random_number(0, 3)];
+    return flags[next_random_number(random, 0, 3)];
 }
 
 
@@ -1135,45 +1819,36 @@ void bounce_off_paddle(BALL *ball, PADDLE *paddle)
 }
 
 
-void play_block_hit_sound()
+/**
+ * Load the sound bank. The block sound is the least important,
+ * since so many blocks get hit.
+ */
+void load_sounds()
 {
-    static ALLEGRO_SAMPLE *sound = NULL;
-    
-    if (sound == NULL) {
-        sound = al_load_sample("sounds/block.wav");
-    }
-    
-    al_play_sample(sound, 1.0, 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+    load_sound(SOUND_BLOCK_HIT, "sounds/block.wav", 1, 2);
+    load_sound(SOUND_PADDLE_HIT, "sounds/paddle.wav", 2, 2);
+    load_sound(SOUND_POWERUP_COLLECTED, "sounds/powerup.wav", 3, 1);
 }
 
 
-void play_paddle_hit_sound()
+/**
+ * Play a sound once the balls are done moving.
+ */
+void queue_ball_sound(BALL *ball, GAME_SOUND sound)
 {
-    static ALLEGRO_SAMPLE *sound = NULL;
-    
-    if (sound == NULL) {
-        sound = al_load_sample("sounds/paddle.wav");
-    }
-    
-    al_play_sample(sound, 1.0, 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+    ball->sounds |= 1 << sound;
 }
 
 
 void play_powerup_collected_sound()
 {
-    static ALLEGRO_SAMPLE *sound = NULL;
-    
-    if (sound == NULL) {
-        sound = al_load_sample("sounds/powerup.wav");
-    }
-    
-    al_play_sample(sound, 1.0, 0.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+    play_sound(SOUND_POWERUP_COLLECTED);
 }
 
 
 void random_ball_direction(BALL *ball)
 {
-    int angle = random_number(0, 359);
+    int angle = next_random_number(&ball->random, 0, 359);
     
     ball->body.velx = velx_from_angle(angle, ball->speed);
     ball->body.vely = vely_from_angle(angle, ball->speed);
@@ -1182,7 +1857,7 @@ void random_ball_direction(BALL *ball)
      * Change the direction the ball is facing.
      * It's cute.
      */
-    ball->facing = random_direction();
+    ball->facing = random_direction(&ball->random);
 }
 
 
@@ -1192,7 +1867,27 @@ void change_ball_facing(BALL *ball)
      * Change the direction the ball is facing.
      * It's cute.
      */
-    ball->facing = random_direction();
+    ball->facing = random_direction(&ball->random);
+}
+
+
+/**
+ * Remember that a ball hit a block, to hit it once the balls are
+ * done moving.
+ */
+void add_ball_hit(BALL *ball, int x, int y, int radius)
+{
+    BALL_HIT *hit = NULL;
+    
+    if (ball->num_hits >= MAX_BALL_HITS) {
+        fprintf(stderr, "WARNING: Failed to hit block, too many hits for one ball.\n");
+        return;
+    }
+    
+    hit = &(ball->hits[ball->num_hits++]);
+    hit->x = x;
+    hit->y = y;
+    hit->radius = radius;
 }
 
 
@@ -1208,9 +1903,10 @@ int check_ball_and_block_collision(BALL *ball, FIELD *field, DIRECTION dir)
     int map_south = 0;
     int map_east = 0;
     
-    BLOCK *a_hit_block = NULL;
+    int hit_x = -1; /* The block that was already hit */
+    int hit_y = -1;
     int collision = 0;
-    int destroy_touching = 0;
+    int radius = 0; /* Of the blast around each block that's hit */
 
     box = &(ball->body.box);
     newx = ball->body.x + change_in_x(dir);
@@ -1223,43 +1919,46 @@ int check_ball_and_block_collision(BALL *ball, FIELD *field, DIRECTION dir)
     map_east = to_map_position(east_edge(newx, box));
     
     if (ball->powerup_type == POWERUP_BLAST) {
-        destroy_touching = 1;
+        radius = BALL_BLAST_RADIUS;
     }
     
     /* Upper left corner */
-    if (get_block_hits(map, map_west, map_north) > 0) {
-        hit_block(field, map, map_west, map_north, destroy_touching);
+    if (is_block_solid(map, map_west, map_north)) {
+        add_ball_hit(ball, map_west, map_north, radius);
         collision = 1;
-        a_hit_block = get_block(map, map_west, map_north);
-        play_block_hit_sound();
+        hit_x = map_west;
+        hit_y = map_north;
+        queue_ball_sound(ball, SOUND_BLOCK_HIT);
     }
 
     /* Upper right corner */
-    if (get_block_hits(map, map_east, map_north) > 0) {
-        if (get_block(map, map_east, map_north) != a_hit_block) {
-            hit_block(field, map, map_east, map_north, destroy_touching);
+    if (is_block_solid(map, map_east, map_north)) {
+        if (map_east != hit_x || map_north != hit_y) {
+            add_ball_hit(ball, map_east, map_north, radius);
             collision = 1;
-            a_hit_block = get_block(map, map_east, map_north);
-            play_block_hit_sound();
+            hit_x = map_east;
+            hit_y = map_north;
+            queue_ball_sound(ball, SOUND_BLOCK_HIT);
         }
     }
 
     /* Lower left corner */
-    if (get_block_hits(map, map_west, map_south) > 0) {
-        if (get_block(map, map_west, map_south) != a_hit_block) {
-            hit_block(field, map, map_west, map_south, destroy_touching);
+    if (is_block_solid(map, map_west, map_south)) {
+        if (map_west != hit_x || map_south != hit_y) {
+            add_ball_hit(ball, map_west, map_south, radius);
             collision = 1;
-            a_hit_block = get_block(map, map_west, map_south);
-            play_block_hit_sound();
+            hit_x = map_west;
+            hit_y = map_south;
+            queue_ball_sound(ball, SOUND_BLOCK_HIT);
         }
     }
 
     /* Lower right corner */
-    if (get_block_hits(map, map_east, map_south) > 0) {
-        if (get_block(map, map_east, map_south) != a_hit_block) {
-            hit_block(field, map, map_east, map_south, destroy_touching);
+    if (is_block_solid(map, map_east, map_south)) {
+        if (map_east != hit_x || map_south != hit_y) {
+            add_ball_hit(ball, map_east, map_south, radius);
             collision = 1;
-            play_block_hit_sound();
+            queue_ball_sound(ball, SOUND_BLOCK_HIT);
         }
     }
     
@@ -1303,9 +2002,9 @@ int check_ball_and_paddle_collision(BALL *ball, FIELD *field, DIRECTION dir)
             hit = 1;
             
             if (!ball->paddlehit) {
-                play_paddle_hit_sound();
+                queue_ball_sound(ball, SOUND_PADDLE_HIT);
                 bounce_off_paddle(ball, field->paddles[i]);
-                ball->facing = random_direction();
+                ball->facing = random_direction(&ball->random);
                 
                 ball->paddlehit = 1;
                 
@@ -1398,7 +2097,7 @@ int move_ball(BALL * ball, FIELD * field, DIRECTION dir)
      */
     if (check_border_collision(&(ball->body), field, dir)) {
         /* The ball hit the border */
-        play_paddle_hit_sound();
+        queue_ball_sound(ball, SOUND_PADDLE_HIT);
         reverse_direction(&(ball->body), dir);
         change_ball_facing(ball);
         moved = 0;
@@ -1462,8 +2161,6 @@ void update_ball(BALL * ball, FIELD * field)
         return;
     }
     
-    animate(ball->anim);
-    
     if (ball->dead) {
         return;
     }
@@ -1545,7 +2242,207 @@ void update_ball(BALL * ball, FIELD * field)
 }
 
 
-void draw_ball(BALL * ball)
+/**
+ * Start moving a batch of balls, unless another thread already
+ * did. Returns false if it was already started.
+ */
+int claim_ball_batch(BALL_BATCH *batch)
+{
+    int claimed = 0;
+    
+    al_lock_mutex(batch->field->ball_mutex);
+    if (!batch->claimed) {
+        batch->claimed = 1;
+        claimed = 1;
+    }
+    al_unlock_mutex(batch->field->ball_mutex);
+    
+    return claimed;
+}
+
+
+void move_ball_batch(BALL_BATCH *batch)
+{
+    FIELD *field = batch->field;
+    int i = 0;
+    
+    for (i = batch->first; i < batch->first + batch->count; i++) {
+        update_ball(field->moving[i], field);
+    }
+    
+    al_lock_mutex(field->ball_mutex);
+    batch->done = 1;
+    al_broadcast_cond(field->ball_cond);
+    al_unlock_mutex(field->ball_mutex);
+}
+
+
+/**
+ * The job that moves a batch of balls on a worker thread.
+ */
+void move_balls_job(void *data)
+{
+    BALL_BATCH *batch = (BALL_BATCH *)data;
+    FIELD *field = batch->field;
+    
+    if (claim_ball_batch(batch)) {
+        move_ball_batch(batch);
+    }
+    
+    /* The field can be destroyed as soon as this is unlocked */
+    al_lock_mutex(field->ball_mutex);
+    field->ball_jobs--;
+    al_broadcast_cond(field->ball_cond);
+    al_unlock_mutex(field->ball_mutex);
+}
+
+
+/**
+ * Hit the blocks that the balls hit and play their sounds, in the
+ * order of the balls, so the game comes out the same no matter
+ * which threads moved them.
+ */
+void apply_ball_hits(FIELD *field)
+{
+    BALL *ball = NULL;
+    BALL_HIT *hit = NULL;
+    int i = 0;
+    int j = 0;
+    
+    for (i = 0; i < MAX_BALLS; i++) {
+        ball = field->balls[i];
+        
+        if (!ball) {
+            continue;
+        }
+        
+        for (j = 0; j < ball->num_hits; j++) {
+            hit = &(ball->hits[j]);
+            blast_area(field, field->map, hit->x, hit->y, hit->radius, BALL_BLAST_SHAPE);
+        }
+        
+        for (j = 0; j < NUM_GAME_SOUNDS; j++) {
+            if (ball->sounds & (1 << j)) {
+                play_sound(j);
+            }
+        }
+        
+        ball->num_hits = 0;
+        ball->sounds = 0;
+    }
+}
+
+
+/**
+ * Move every ball. The map doesn't change while they move, so with
+ * enough balls they're moved in batches by the worker threads.
+ * The batches go ahead of the slow jobs, like loading levels, and
+ * the game thread never waits for room in the queue. It moves any
+ * batch that a worker hasn't started itself instead.
+ */
+void move_balls(FIELD *field)
+{
+    BALL_BATCH *batch = NULL;
+    int num_balls = 0;
+    int done = 0;
+    int i = 0;
+    
+    for (i = 0; i < MAX_BALLS; i++) {
+        if (field->balls[i]) {
+            field->moving[num_balls++] = field->balls[i];
+        }
+    }
+    
+    if (num_balls < MIN_PARALLEL_BALLS) {
+        for (i = 0; i < MAX_BALLS; i++) {
+            update_ball(field->balls[i], field);
+        }
+    } else {
+        al_lock_mutex(field->ball_mutex);
+        for (i = 0; i < BALL_BATCHES; i++) {
+            field->batches[i].first = i * num_balls / BALL_BATCHES;
+            field->batches[i].count = (i + 1) * num_balls / BALL_BATCHES - field->batches[i].first;
+            field->batches[i].claimed = 0;
+            field->batches[i].done = 0;
+        }
+        field->ball_jobs += BALL_BATCHES - 1;
+        al_unlock_mutex(field->ball_mutex);
+        
+        for (i = 0; i < BALL_BATCHES - 1; i++) {
+            if (!add_urgent_job(move_balls_job, &field->batches[i])) {
+                al_lock_mutex(field->ball_mutex);
+                field->ball_jobs--;
+                al_unlock_mutex(field->ball_mutex);
+            }
+        }
+        
+        for (i = BALL_BATCHES - 1; i >= 0; i--) {
+            batch = &field->batches[i];
+            
+            if (claim_ball_batch(batch)) {
+                move_ball_batch(batch);
+            }
+        }
+        
+        /* Wait for the batches the workers are still moving */
+        al_lock_mutex(field->ball_mutex);
+        while (!done) {
+            done = 1;
+            for (i = 0; i < BALL_BATCHES; i++) {
+                if (!field->batches[i].done) {
+                    done = 0;
+                }
+            }
+            
+            if (!done) {
+                al_wait_cond(field->ball_cond, field->ball_mutex);
+            }
+        }
+        al_unlock_mutex(field->ball_mutex);
+    }
+    
+    apply_ball_hits(field);
+}
+
+
+/**
+ * Check if any of a sprite is inside the visible part of the field.
+ * Balls can be rotated, so the biggest side is used both ways.
+ */
+int is_sprite_visible(SPRITE *sprite, RECT *visible)
+{
+    int half = 0;
+    
+    /* There's no frame if its clip failed to load */
+    if (sprite->bitmap == NULL) {
+        return 0;
+    }
+    
+    half = al_get_bitmap_width(sprite->bitmap);
+    
+    if (al_get_bitmap_height(sprite->bitmap) > half) {
+        half = al_get_bitmap_height(sprite->bitmap);
+    }
+    half = half / 2 + 1;
+    
+    return sprite->x + half >= visible->x && sprite->x - half < visible->x + visible->w &&
+           sprite->y + half >= visible->y && sprite->y - half < visible->y + visible->h;
+}
+
+
+void draw_sprite(SPRITE *sprite)
+{
+    int x = 0;
+    int y = 0;
+    
+    x = sprite->x - (al_get_bitmap_width(sprite->bitmap) / 2);
+    y = sprite->y - (al_get_bitmap_height(sprite->bitmap) / 2);
+
+    al_draw_bitmap(sprite->bitmap, x, y, 0);
+}
+
+
+void draw_ball(SPRITE *sprite)
 {
     int xhalf = 0;
     int yhalf = 0;
@@ -1553,81 +2450,305 @@ void draw_ball(BALL * ball)
     int y = 0;
     ALLEGRO_BITMAP *frame = NULL;
 
-    if (!ball) {
+    xhalf = al_get_bitmap_width(sprite->bitmap) / 2;
+    yhalf = al_get_bitmap_height(sprite->bitmap) / 2;
+    x = sprite->x;
+    y = sprite->y;
+    frame = sprite->bitmap;
+    
+    /* Rotating is expensive, skip it when the game is running slow */
+    if (get_quality() >= QUALITY_NO_ROTATION) {
+        al_draw_bitmap(frame, x - xhalf, y - yhalf, 0);
         return;
     }
-    
-    xhalf = anim_width(ball->anim) / 2;
-    yhalf = anim_height(ball->anim) / 2;
-    x = ball->body.x;
-    y = ball->body.y;
-    frame = current_frame(ball->anim);
 
     /**
      * The first set of points will be drawn onto the target
      * bitmap at the second set of points.
      */
-    al_draw_rotated_bitmap(frame, xhalf, yhalf, x, y, ball->facing, 0);
+    al_draw_rotated_bitmap(frame, xhalf, yhalf, x, y, sprite->angle, 0);
 }
 
 
-void draw_background()
+void draw_background(RECT *visible)
 {
+    static RESOURCE_HANDLE handle = NO_RESOURCE;
     ALLEGRO_BITMAP *background = NULL;
     int width = 0;
     int height = 0;
     int x = 0;
     int y = 0;
 
-    background = load_resource_image("background.bmp");
+    if (handle == NO_RESOURCE) {
+        handle = find_resource_handle("background.bmp");
+    }
+    background = resource_handle_image(handle);
     width = al_get_bitmap_width(background);
     height = al_get_bitmap_height(background);
 
-    for (y = 0; y <= CANVAS_H; y += height) {
-        for (x = 0; x <= CANVAS_W; x += width) {
+    /* Only tile over the visible part of the field */
+    for (y = visible->y - (visible->y % height); y < visible->y + visible->h; y += height) {
+        for (x = visible->x - (visible->x % width); x < visible->x + visible->w; x += width) {
             al_draw_bitmap(background, x, y, 0);
         }
     }
 }
 
 
-void draw_border(FIELD *field)
+/**
+ * Draw the border around a field of the given size, in pixels.
+ * Only the pieces inside the visible part of the field are drawn.
+ */
+void draw_border(int width, int height, RECT *visible)
 {
+    static RESOURCE_HANDLE handles[4] = {NO_RESOURCE, NO_RESOURCE, NO_RESOURCE, NO_RESOURCE};
     ALLEGRO_BITMAP *bn = NULL;
     ALLEGRO_BITMAP *bs = NULL;
     ALLEGRO_BITMAP *bw = NULL;
     ALLEGRO_BITMAP *be = NULL;
-    int width = 0;
-    int height = 0;
+    int right = visible->x + visible->w;
+    int bottom = visible->y + visible->h;
+    int step = 0;
     int i = 0;
     
-    bn = load_resource_image("border-north.bmp");
-    bs = load_resource_image("border-south.bmp");
-    bw = load_resource_image("border-west.bmp");
-    be = load_resource_image("border-east.bmp");
-
-    width = field->map->width * BLOCK_SIZE;
-    height = field->map->height * BLOCK_SIZE;
+    if (handles[0] == NO_RESOURCE) {
+        handles[0] = find_resource_handle("border-north.bmp");
+        handles[1] = find_resource_handle("border-south.bmp");
+        handles[2] = find_resource_handle("border-west.bmp");
+        handles[3] = find_resource_handle("border-east.bmp");
+    }
+    
+    bn = resource_handle_image(handles[0]);
+    bs = resource_handle_image(handles[1]);
+    bw = resource_handle_image(handles[2]);
+    be = resource_handle_image(handles[3]);
 
     /* Draw the north border */
-    for (i = 0; i <= width; i += al_get_bitmap_width(bn)) {
-        al_draw_bitmap(bn, i, 0, 0);
+    if (visible->y < al_get_bitmap_height(bn)) {
+        step = al_get_bitmap_width(bn);
+        for (i = visible->x - (visible->x % step); i <= width && i < right; i += step) {
+            al_draw_bitmap(bn, i, 0, 0);
+        }
     }
 
     /* Draw the east border */
-    for (i = 0; i <= height; i += al_get_bitmap_height(be)) {
-        al_draw_bitmap(be, width - al_get_bitmap_width(be), i, 0);
+    if (right > width - al_get_bitmap_width(be)) {
+        step = al_get_bitmap_height(be);
+        for (i = visible->y - (visible->y % step); i <= height && i < bottom; i += step) {
+            al_draw_bitmap(be, width - al_get_bitmap_width(be), i, 0);
+        }
     }
 
     /* Draw the south border */
-    for (i = 0; i <= width; i += al_get_bitmap_width(bs)) {
-        al_draw_bitmap(bs, i, height - al_get_bitmap_height(bs), 0);
+    if (bottom > height - al_get_bitmap_height(bs)) {
+        step = al_get_bitmap_width(bs);
+        for (i = visible->x - (visible->x % step); i <= width && i < right; i += step) {
+            al_draw_bitmap(bs, i, height - al_get_bitmap_height(bs), 0);
+        }
     }
 
     /* Draw the west border */
-    for (i = 0; i <= height; i += al_get_bitmap_height(bw)) {
-        al_draw_bitmap(bw, 0, i, 0);
+    if (visible->x < al_get_bitmap_width(bw)) {
+        step = al_get_bitmap_height(bw);
+        for (i = visible->y - (visible->y % step); i <= height && i < bottom; i += step) {
+            al_draw_bitmap(bw, 0, i, 0);
+        }
+    }
+}
+
+
+/**
+ * Make the blocks of a chunk. This runs on a worker thread, so
+ * it has its own random numbers, and the same chunk of the same
+ * endless map always comes out the same.
+ */
+void generate_chunk(void *data)
+{
+    CHUNK *chunk = (CHUNK *)data;
+    RANDOM random;
+    int percent = 0;
+    int extra_hits = 0;
+    int half = ENDLESS_WIDTH / 2;
+    int rows = CHUNK_ROWS;
+    int type = 0;
+    int x = 0;
+    int y = 0;
+    
+    seed_random_state(&random, chunk->seed + chunk->number);
+    
+    /* Later chunks are harder */
+    percent = 20 + (chunk->number < 8 ? chunk->number * 5 : 40);
+    extra_hits = chunk->number < 8 ? chunk->number / 4 : 2;
+    
+    /* Leave room for the paddle and the ball at the start */
+    if (chunk->number == 0) {
+        rows = CHUNK_ROWS - ENDLESS_START_ROWS;
+    }
+    
+    memset(chunk->types, NO_BLOCK_TYPE, sizeof(chunk->types));
+    memset(chunk->hits, 0, sizeof(chunk->hits));
+    
+    /* Each row is made on the left and mirrored on the right */
+    for (y = 0; y < rows; y++) {
+        type = chunk->palette[next_random_number(&random, 0, NUM_ENDLESS_BLOCKS - 1)];
+        
+        if (type == NO_BLOCK_TYPE) {
+            continue;
+        }
+        
+        for (x = 0; x < half; x++) {
+            if (next_random_number(&random, 1, 100) > percent) {
+                continue;
+            }
+            
+            chunk->types[(y * ENDLESS_WIDTH) + x] = type;
+            chunk->types[(y * ENDLESS_WIDTH) + ENDLESS_WIDTH - 1 - x] = type;
+            chunk->hits[(y * ENDLESS_WIDTH) + x] = get_block_type(type)->hits +
+                next_random_number(&random, 0, extra_hits);
+            chunk->hits[(y * ENDLESS_WIDTH) + ENDLESS_WIDTH - 1 - x] = chunk->hits[(y * ENDLESS_WIDTH) + x];
+        }
+    }
+    
+    al_lock_mutex(chunk->mutex);
+    chunk->done = 1;
+    al_unlock_mutex(chunk->mutex);
+}
+
+
+CHUNK *create_chunk(ENDLESS *endless)
+{
+    CHUNK *chunk = alloc_memory("CHUNK", sizeof(CHUNK));
+    
+    chunk->number = endless->next_chunk++;
+    chunk->seed = endless->seed;
+    memcpy(chunk->palette, endless->types, sizeof(chunk->palette));
+    chunk->done = 0;
+    chunk->mutex = al_create_mutex();
+    
+    return chunk;
+}
+
+
+void destroy_chunk(CHUNK *chunk)
+{
+    if (chunk) {
+        al_destroy_mutex(chunk->mutex);
+    }
+    
+    free_memory("CHUNK", chunk);
+}
+
+
+/**
+ * Start making the next chunk on a worker thread.
+ */
+CHUNK *start_chunk(ENDLESS *endless)
+{
+    CHUNK *chunk = create_chunk(endless);
+    
+    add_group_job(&endless->jobs, generate_chunk, chunk);
+    
+    return chunk;
+}
+
+
+int is_chunk_done(CHUNK *chunk)
+{
+    int done = 0;
+    
+    al_lock_mutex(chunk->mutex);
+    done = chunk->done;
+    al_unlock_mutex(chunk->mutex);
+    
+    return done;
+}
+
+
+void destroy_endless(ENDLESS *endless)
+{
+    if (!endless) {
+        return;
+    }
+    
+    /* The worker might still be making the next chunk */
+    if (endless->pending) {
+        wait_for_job_group(&endless->jobs);
+        destroy_chunk(endless->pending);
+    }
+    
+    free_memory("ENDLESS", endless);
+}
+
+
+/**
+ * Move everything on the field down, after rows were added to
+ * the top of the map.
+ */
+void shift_field(FIELD *field, float dy)
+{
+    int i = 0;
+    
+    for (i = 0; i < field->num_paddles; i++) {
+        field->paddles[i]->body.y += dy;
+    }
+    
+    for (i = 0; i < field->num_holes; i++) {
+        field->holes[i]->body.y += dy;
+    }
+    
+    for (i = 0; i < MAX_BALLS; i++) {
+        if (field->balls[i]) {
+            field->balls[i]->body.y += dy;
+        }
+    }
+    
+    for (i = 0; i < MAX_POWERUPS; i++) {
+        if (field->powerups[i]) {
+            field->powerups[i]->body.y += dy;
+        }
+    }
+    
+    field->default_ball_y += dy;
+    field->camera_y += dy;
+}
+
+
+/**
+ * Put a chunk on top of an endless map. The bottom chunk is
+ * thrown out to make room, so the map always takes the same
+ * amount of memory.
+ */
+void attach_chunk(FIELD *field, CHUNK *chunk)
+{
+    MAP *map = field->map;
+    int kept = map->height - CHUNK_ROWS;
+    int i = 0;
+    int x = 0;
+    int y = 0;
+    
+    /* Clear out the bottom chunk */
+    for (y = kept; y < map->height; y++) {
+        for (x = 0; x < map->width; x++) {
+            set_block(map, x, y, NO_BLOCK_TYPE, 0);
+        }
     }
+    
+    /* Move the rest of the map down, the top rows are empty after this */
+    memmove(map->blocks + (CHUNK_ROWS * map->width), map->blocks,
+            kept * map->width * sizeof(BLOCK));
+    memset(map->blocks, 0, CHUNK_ROWS * map->width * sizeof(BLOCK));
+    
+    memmove(map->board + (CHUNK_ROWS * map->board_width), map->board,
+            kept * map->board_width * sizeof(unsigned long));
+    memset(map->board, 0, CHUNK_ROWS * map->board_width * sizeof(unsigned long));
+    
+    for (i = 0; i < CHUNK_ROWS * ENDLESS_WIDTH; i++) {
+        if (chunk->types[i] != NO_BLOCK_TYPE) {
+            set_block(map, i % ENDLESS_WIDTH, i / ENDLESS_WIDTH, chunk->types[i], chunk->hits[i]);
+        }
+    }
+    
+    shift_field(field, CHUNK_ROWS * BLOCK_SIZE);
 }
 
 
@@ -1649,6 +2770,20 @@ FIELD *create_field()
     for (i = 0; i < MAX_BALLS; i++) {
         field->balls[i] = NULL;
     }
+    
+    for (i = 0; i < BALL_BATCHES; i++) {
+        field->batches[i].field = field;
+        field->batches[i].first = 0;
+        field->batches[i].count = 0;
+        field->batches[i].claimed = 1;
+        field->batches[i].done = 1;
+    }
+    
+    seed_random_state(&field->random, 0);
+    
+    field->ball_jobs = 0;
+    field->ball_mutex = al_create_mutex();
+    field->ball_cond = al_create_cond();
 
     for (i = 0; i < MAX_HOLES; i++) {
         field->holes[i] = NULL;
@@ -1661,7 +2796,23 @@ FIELD *create_field()
     }
     
     field->events = al_create_event_queue();
-    al_register_event_source(field->events, al_get_mouse_event_source());
+    
+    /* There's no mouse when running benchmarks and tests */
+    if (al_is_mouse_installed()) {
+        al_register_event_source(field->events, al_get_mouse_event_source());
+    }
+    
+    field->shadow_offset = MIN_BALL_SHADOW_OFFSET;
+    field->shadow_increase = 1;
+    
+    field->tick = 0;
+    
+    field->camera_x = 0;
+    field->camera_y = 0;
+    
+    field->endless = NULL;
+    
+    field->powerup_percent = DEFAULT_LEVEL_POWERUPS;
     
     field->default_ball_x = -1;
     field->default_ball_y = -1;
@@ -1680,7 +2831,18 @@ void destroy_field(FIELD * field)
         return;
     }
 
+    destroy_endless(field->endless);
     destroy_map(field->map);
+    
+    /* Wait for ball jobs that started after the balls were moved without them */
+    al_lock_mutex(field->ball_mutex);
+    while (field->ball_jobs > 0) {
+        al_wait_cond(field->ball_cond, field->ball_mutex);
+    }
+    al_unlock_mutex(field->ball_mutex);
+    
+    al_destroy_cond(field->ball_cond);
+    al_destroy_mutex(field->ball_mutex);
 
     for (i = 0; i < MAX_BALLS; i++) {
         destroy_ball(field->balls[i]);
@@ -1755,8 +2917,21 @@ void update_field(FIELD * field, GAME *game)
 {
     BALL *ball;
     ALLEGRO_EVENT event;
+    ALLEGRO_BITMAP *hole_frame = NULL;
+    unsigned long last_hole_tick = hole_tick(field);
+    float paddle_x[MAX_PADDLES];
+    float paddle_y[MAX_PADDLES];
+    int changed = 0;
     int i = 0;
     
+    /* Animations are worked out from the tick when they're drawn */
+    field->tick++;
+    
+    for (i = 0; i < field->num_paddles; i++) {
+        paddle_x[i] = field->paddles[i]->body.x;
+        paddle_y[i] = field->paddles[i]->body.y;
+    }
+    
     /* Update paddle movement with player input */
     while (al_get_next_event(field->events, &event)) {
         for (i = 0; i < field->num_paddles; i++) {
@@ -1765,11 +2940,22 @@ void update_field(FIELD * field, GAME *game)
     }
 
     for (i = 0; i < field->num_paddles; i++) {
-        update_paddle_with_keyboard(field->paddles[i], field);
+        if (al_is_keyboard_installed()) {
+            update_paddle_with_keyboard(field->paddles[i], field);
+        }
+        
+        if (field->paddles[i]->body.x != paddle_x[i] ||
+            field->paddles[i]->body.y != paddle_y[i]) {
+            changed = 1;
+        }
     }
     
     /* Update the powerups */
     for (i = 0; i < MAX_POWERUPS; i++) {
+        if (field->powerups[i]) {
+            /* Powerups never stop moving */
+            changed = 1;
+        }
         update_powerup(field->powerups[i], field);
     }
 
@@ -1778,9 +2964,24 @@ void update_field(FIELD * field, GAME *game)
         check_paddle_and_powerup_collision(field->paddles[i], field);
     }
     
+    /* Make the ball shadows "bounce" */
+    if (field->shadow_increase) {
+        field->shadow_offset += BALL_SHADOW_SPEED;
+    } else {
+        field->shadow_offset -= BALL_SHADOW_SPEED;
+    }
+    if (field->shadow_offset >= MAX_BALL_SHADOW_OFFSET || field->shadow_offset <= MIN_BALL_SHADOW_OFFSET) {
+        field->shadow_increase = field->shadow_increase ? 0 : 1;
+    }
+    
     /* Move the balls */
+    move_balls(field);
+    
     for (i = 0; i < MAX_BALLS; i++) {
-        update_ball(field->balls[i], field);
+        if (field->balls[i]) {
+            /* Balls never stop moving */
+            changed = 1;
+        }
         
         /* Remove dead balls */
         if (field->balls[i] && field->balls[i]->dead) {
@@ -1790,7 +2991,8 @@ void update_field(FIELD * field, GAME *game)
             
             /* If the player has any more tries left, create a new ball */
             if (game->player->lives > 0) {
-                ball = create_ball(field->default_ball_x, field->default_ball_y, 0);
+                ball = create_ball(field->default_ball_x, field->default_ball_y, 0,
+                                   next_random_number(&field->random, 0, MAX_FIELD_SEED));
                 ball->body.velx = field->default_ball_velx;
                 ball->body.vely = field->default_ball_vely;
                 add_ball(field, ball);
@@ -1798,82 +3000,269 @@ void update_field(FIELD * field, GAME *game)
         }
     }
 
+    if (update_camera(field, CAMERA_FOLLOW)) {
+        changed = 1;
+    }
+    
     /* Update the mean old holes */
     for (i = 0; i < field->num_holes; i++) {
+        hole_frame = anim_frame(&field->holes[i]->anim, last_hole_tick);
+        
         update_hole(field->holes[i], field);
+        
+        if (anim_frame(&field->holes[i]->anim, hole_tick(field)) != hole_frame) {
+            changed = 1;
+        }
+    }
+    
+    /* Only redraw the field if something on it changed */
+    if (changed) {
+        request_redraw();
     }
 }
 
 
-void draw_field(FIELD * field)
+/**
+ * Fill in a snapshot with everything needed to draw the field.
+ */
+void snap_field(FIELD *field, SNAPSHOT *snapshot)
 {
-    PADDLE *paddle;
-    BALL *ball;
+    MAP *map = field->map;
+    BLOCK *block = NULL;
+    SPRITE *sprite = NULL;
+    BALL *ball = NULL;
+    int size = 0;
     int x = 0;
     int y = 0;
     int i = 0;
     
-    static int shadow_increase = 1;
-    static float shadow_offsetx = 4;
-    static float shadow_offsety = 4;
-
-    /* Redraw the background */
-    draw_background();
-
-    /* Draw the shadows */
+    snapshot->map_width = map->width;
+    snapshot->map_height = map->height;
+    field_view(field, &snapshot->view);
+    snapshot->shadow_offset = field->shadow_offset;
+    
+    snapshot->num_paddles = 0;
     for (i = 0; i < field->num_paddles; i++) {
-        paddle = field->paddles[i];
-        x = paddle->body.x - (al_get_bitmap_width(paddle->shadow) / 2);
-        y = paddle->body.y - (al_get_bitmap_height(paddle->shadow) / 2);
-        al_draw_bitmap(paddle->shadow, x - 4, y + 4, 0);
+        sprite = &(snapshot->paddles[snapshot->num_paddles++]);
+        sprite->bitmap = anim_frame(&field->paddles[i]->anim, field->tick);
+        sprite->shadow = field->paddles[i]->shadow;
+        sprite->x = field->paddles[i]->body.x;
+        sprite->y = field->paddles[i]->body.y;
+        sprite->angle = 0;
     }
     
-    /* Make the ball shadow "bounce" */
-    if (shadow_increase) {
-        shadow_offsetx += 0.4;
-        shadow_offsety += 0.4;
-    } else {
-        shadow_offsetx -= 0.4;
-        shadow_offsety -= 0.4;
+    snapshot->num_holes = 0;
+    for (i = 0; i < field->num_holes; i++) {
+        sprite = &(snapshot->holes[snapshot->num_holes++]);
+        sprite->bitmap = anim_frame(&field->holes[i]->anim, hole_tick(field));
+        sprite->shadow = NULL;
+        sprite->x = field->holes[i]->body.x;
+        sprite->y = field->holes[i]->body.y;
+        sprite->angle = 0;
     }
-    if (shadow_offsetx >= 16 || shadow_offsetx <= 4) {
-        shadow_increase = shadow_increase ? 0 : 1;
+    
+    snapshot->num_powerups = 0;
+    for (i = 0; i < MAX_POWERUPS; i++) {
+        if (field->powerups[i]) {
+            sprite = &(snapshot->powerups[snapshot->num_powerups++]);
+            sprite->bitmap = anim_frame(&field->powerups[i]->anim, field->tick);
+            sprite->shadow = NULL;
+            sprite->x = field->powerups[i]->body.x;
+            sprite->y = field->powerups[i]->body.y;
+            sprite->angle = 0;
+        }
     }
     
+    snapshot->num_balls = 0;
     for (i = 0; i < MAX_BALLS; i++) {
         ball = field->balls[i];
         if (ball) {
-            x = ball->body.x - (al_get_bitmap_width(ball->shadow) / 2);
-            y = ball->body.y - (al_get_bitmap_height(ball->shadow) / 2);
-            al_draw_bitmap(ball->shadow, x - (int)shadow_offsetx, y + (int)shadow_offsety, 0);
+            sprite = &(snapshot->balls[snapshot->num_balls++]);
+            sprite->bitmap = anim_frame(&ball->anim, field->tick);
+            sprite->shadow = ball->shadow;
+            sprite->x = ball->body.x;
+            sprite->y = ball->body.y;
+            sprite->angle = ball->facing;
+        }
+    }
+    
+    /* Copy the blocks in view, the render thread doesn't look at the others */
+    snapshot->cells_x = snapshot->view.x / BLOCK_SIZE;
+    snapshot->cells_y = snapshot->view.y / BLOCK_SIZE;
+    snapshot->cells_w = (snapshot->view.x + snapshot->view.w - 1) / BLOCK_SIZE - snapshot->cells_x + 1;
+    snapshot->cells_h = (snapshot->view.y + snapshot->view.h - 1) / BLOCK_SIZE - snapshot->cells_y + 1;
+    
+    if (snapshot->cells_x + snapshot->cells_w > map->width) {
+        snapshot->cells_w = map->width - snapshot->cells_x;
+    }
+    if (snapshot->cells_y + snapshot->cells_h > map->height) {
+        snapshot->cells_h = map->height - snapshot->cells_y;
+    }
+    
+    size = snapshot->cells_w * snapshot->cells_h;
+    
+    if (snapshot->cells_size < size) {
+        free_memory("SNAPSHOT CELLS", snapshot->cells);
+        snapshot->cells = calloc_memory("SNAPSHOT CELLS", size, sizeof(ALLEGRO_BITMAP *));
+        snapshot->cells_size = size;
+    }
+    
+    for (y = 0; y < snapshot->cells_h; y++) {
+        for (x = 0; x < snapshot->cells_w; x++) {
+            block = &(map->blocks[((snapshot->cells_y + y) * map->width) + snapshot->cells_x + x]);
+            snapshot->cells[(y * snapshot->cells_w) + x] =
+                block->hits > 0 ? block_type_image(get_block_type(block->type), block->hits) : NULL;
         }
     }
+}
+
+
+/**
+ * Draw the shadow of a sprite onto the shadow layer.
+ */
+void draw_shadow_silhouette(SPRITE *sprite, RECT *visible, int offsetx, int offsety)
+{
+    int x = 0;
+    int y = 0;
+    
+    if (sprite->shadow == NULL) {
+        return;
+    }
+    
+    x = sprite->x - (al_get_bitmap_width(sprite->shadow) / 2) - visible->x;
+    y = sprite->y - (al_get_bitmap_height(sprite->shadow) / 2) - visible->y;
+    
+    al_draw_bitmap(sprite->shadow, x + offsetx + SHADOW_MARGIN, y + offsety + SHADOW_MARGIN, 0);
+}
+
+
+/**
+ * Draw every shadow on the field. All of the shadows are drawn
+ * onto one layer first, and the layer is put on the field in one
+ * go, so the shadows cost the same no matter how many there are.
+ * The layer only covers the visible part of the field.
+ */
+void draw_shadows(SNAPSHOT *snapshot)
+{
+    static ALLEGRO_BITMAP *layer = NULL;
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    float opacity = SHADOW_OPACITY;
+    int offset = snapshot->shadow_offset;
+    RECT *visible = &(snapshot->view);
+    int w = visible->w + SHADOW_MARGIN * 2;
+    int h = visible->h + SHADOW_MARGIN * 2;
+    int i = 0;
+    
+    if (snapshot->num_paddles == 0 && snapshot->num_balls == 0) {
+        return;
+    }
+    
+    if (layer == NULL || al_get_bitmap_width(layer) != w || al_get_bitmap_height(layer) != h) {
+        al_destroy_bitmap(layer);
+        layer = al_create_bitmap(w, h);
+    }
+    
+    al_set_target_bitmap(layer);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    
+    /**
+     * The whole layer is moved by the ball shadow offset, so move
+     * the paddle shadows back by the same amount to keep them still.
+     */
+    for (i = 0; i < snapshot->num_paddles; i++) {
+        draw_shadow_silhouette(&(snapshot->paddles[i]), visible,
+                               offset - PADDLE_SHADOW_OFFSET,
+                               PADDLE_SHADOW_OFFSET - offset);
+    }
+    
+    for (i = 0; i < snapshot->num_balls; i++) {
+        draw_shadow_silhouette(&(snapshot->balls[i]), visible, 0, 0);
+    }
+    
+    al_set_target_bitmap(target);
+    
+    al_draw_tinted_bitmap(layer, al_map_rgba_f(opacity, opacity, opacity, opacity),
+                          visible->x - offset - SHADOW_MARGIN,
+                          visible->y + offset - SHADOW_MARGIN, 0);
+}
+
+
+/**
+ * Draw the visible part of the field from a snapshot, with the
+ * top left of the view at the top left of the target.
+ * Only call this from the render thread.
+ */
+void draw_field(SNAPSHOT *snapshot)
+{
+    ALLEGRO_TRANSFORM transform;
+    RECT *visible = &(snapshot->view);
+    int i = 0;
+    
+    /* Everything is drawn in field positions */
+    al_identity_transform(&transform);
+    al_translate_transform(&transform, -visible->x, -visible->y);
+    al_use_transform(&transform);
+
+    /* Redraw the background */
+    start_layer();
+    draw_background(visible);
+    end_layer(LAYER_BACKGROUND);
+    
+    /* Draw the shadows, unless the game is running slow */
+    start_layer();
+    if (get_quality() < QUALITY_NO_SHADOWS) {
+        draw_shadows(snapshot);
+    }
+    end_layer(LAYER_SHADOWS);
     
     /* Draw the holes */
-    for (i = 0; i < field->num_holes; i++) {
-        draw_hole(field->holes[i]);
+    start_layer();
+    for (i = 0; i < snapshot->num_holes; i++) {
+        if (is_sprite_visible(&(snapshot->holes[i]), visible)) {
+            draw_sprite(&(snapshot->holes[i]));
+        }
     }
+    end_layer(LAYER_HOLES);
 
     /* Draw the demo map */
-    draw_map(field->map);
+    start_layer();
+    draw_map(snapshot);
+    end_layer(LAYER_MAP);
 
     /* Draw the paddles */
-    for (i = 0; i < field->num_paddles; i++) {
-        draw_paddle(field->paddles[i]);
+    start_layer();
+    for (i = 0; i < snapshot->num_paddles; i++) {
+        if (is_sprite_visible(&(snapshot->paddles[i]), visible)) {
+            draw_sprite(&(snapshot->paddles[i]));
+        }
     }
+    end_layer(LAYER_PADDLES);
 
     /* Draw the powerups */
-    for (i = 0; i < MAX_POWERUPS; i++) {
-        draw_powerup(field->powerups[i]);
+    start_layer();
+    for (i = 0; i < snapshot->num_powerups; i++) {
+        if (is_sprite_visible(&(snapshot->powerups[i]), visible)) {
+            draw_sprite(&(snapshot->powerups[i]));
+        }
     }
+    end_layer(LAYER_POWERUPS);
 
     /* Draw the balls */
-    for (i = 0; i < MAX_BALLS; i++) {
-        draw_ball(field->balls[i]);
+    start_layer();
+    for (i = 0; i < snapshot->num_balls; i++) {
+        if (is_sprite_visible(&(snapshot->balls[i]), visible)) {
+            draw_ball(&(snapshot->balls[i]));
+        }
     }
+    end_layer(LAYER_BALLS);
 
     /* Draw the border */
-    draw_border(field);
+    start_layer();
+    draw_border(snapshot->map_width * BLOCK_SIZE, snapshot->map_height * BLOCK_SIZE, visible);
+    end_layer(LAYER_BORDER);
+    
+    al_identity_transform(&transform);
+    al_use_transform(&transform);
 }
 
 
@@ -1889,10 +3278,14 @@ void add_paddle(FIELD * field, PADDLE * paddle)
 }
 
 
+/**
+ * Add a hole to a field. If there's no room for it, it's destroyed.
+ */
 void add_hole(FIELD * field, HOLE *hole)
 {
-    if (field->num_holes >= MAX_HOLES - 1) {
+    if (field->num_holes >= MAX_HOLES) {
         fprintf(stderr, "Failed to add hole.\n");
+        destroy_hole(hole);
         return;
     }
 
@@ -1935,6 +3328,9 @@ GAME *create_game()
     
     game->field = NULL;
     game->player = NULL;
+    game->level = 0;
+    game->next_level = NULL;
+    game->next_field = NULL;
     game->mousescale = 1;
     
     return game;
@@ -1944,6 +3340,7 @@ GAME *create_game()
 void destroy_game(GAME *game)
 {
     if (game) {
+        destroy_field(game->next_field);
         destroy_field(game->field);
         destroy_player(game->player);
     }
@@ -1954,11 +3351,15 @@ void destroy_game(GAME *game)
 
 void draw_wallpaper()
 {
+    static RESOURCE_HANDLE handle = NO_RESOURCE;
     ALLEGRO_BITMAP *bitmap = NULL;
     int x = 0;
     int y = 0;
     
-    bitmap = load_resource_image("wallpaper.bmp");
+    if (handle == NO_RESOURCE) {
+        handle = find_resource_handle("wallpaper.bmp");
+    }
+    bitmap = resource_handle_image(handle);
     
     for (y = 0; y < CANVAS_H; y += al_get_bitmap_height(bitmap)) {
         for (x = 0; x < CANVAS_W; x += al_get_bitmap_width(bitmap)) {
@@ -1968,52 +3369,56 @@ void draw_wallpaper()
 }
 
 
-int update_game(void *data)
-{
-    GAME *game = (GAME *)data;
-    
-    update_field(game->field, game);
-    
-    /* Press escape to quit */
-    if (is_key_pressed(ALLEGRO_KEY_ESCAPE)) {
-        return 0;
-    }
-    
-    return 1;
-}
-
-
-void draw_game(void *data)
+void draw_game(SNAPSHOT *snapshot)
 {
     static ALLEGRO_BITMAP *canvas = NULL;
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
     int x = 0;
     int y = 0;
     int w = 0;
     int h = 0;
     
-    GAME *game = (GAME *)data;
-    
+    start_layer();
     draw_wallpaper();
+    end_layer(LAYER_WALLPAPER);
     
-    /* Draw the field centered on the canvas */
+    /* Draw the visible part of the field centered on the canvas */
     
-    w = field_width(game->field);
-    h = field_height(game->field);
+    w = snapshot->view.w;
+    h = snapshot->view.h;
     x = (CANVAS_W - w) / 2;
     y = (CANVAS_H - h) / 2;
 
-    if (canvas == NULL || (al_get_bitmap_width(canvas) != w && al_get_bitmap_height(canvas) != h)) {
+    if (canvas == NULL || al_get_bitmap_width(canvas) != w || al_get_bitmap_height(canvas) != h) {
         al_destroy_bitmap(canvas);
         canvas = al_create_bitmap(w, h);
     }
     
     al_set_target_bitmap(canvas);
-    draw_field(game->field);
+    draw_field(snapshot);
+    
+    /* Put the target back to normal */
+    al_set_target_bitmap(target);
+    
+    start_layer();
+    if (snapshot->paused) {
+        /* Darken the field while the game is paused */
+        al_draw_tinted_bitmap(canvas, al_map_rgb_f(0.5, 0.5, 0.5), x, y, 0);
+    } else {
+        al_draw_bitmap(canvas, x, y, 0);
+    }
+    end_layer(LAYER_CANVAS);
+}
+
+
+void snap_game(void *data, SNAPSHOT *snapshot)
+{
+    GAME *game = (GAME *)data;
     
-    /* Put the display back to normal */
-    al_set_target_bitmap(al_get_backbuffer(display));
+    snapshot->draw = draw_game;
+    snapshot->paused = paused;
     
-    al_draw_bitmap(canvas, x, y, 0);
+    snap_field(game->field, snapshot);
 }
 
 
@@ -2031,381 +3436,1617 @@ float cap_angle(float angle)
 }
 
 
-#define CHAR_FORMAT_SKIP_WHITESPACE "%*[ \n\t]%c"
-
-
-PADDLE *load_paddle(FILE *file)
+/**
+ * Build a field out of a level. If parallel is true, the block
+ * images are loaded by the worker threads, so don't set it
+ * when this is called by a worker. The field's random numbers
+ * start from the seed, since the shared ones aren't safe to
+ * use from a worker.
+ */
+FIELD *build_field(LEVEL *level, int parallel, unsigned long seed)
 {
-    int x = 0;
-    int y = 0;
-    char orientation = 0;
+    int types[MAX_LEVEL_BLOCK_IDS];
+    JOB_GROUP images;
+    LEVEL_BLOCK_ID *block_id = NULL;
+    LEVEL_CELL *cell = NULL;
+    FIELD *field = NULL;
+    MAP *map = NULL;
+    int i = 0;
     
-    /* X position */
-    if (fscanf(file, "%d", &x) != 1) {
-        fprintf(stderr, "Failed to load paddle x position.\n");
-        return NULL;
-    }
+    field = create_field();
+    field->powerup_percent = level->powerup_percent;
+    seed_random_state(&field->random, seed);
+    
+    for (i = 0; i < level->num_paddles; i++) {
+        add_paddle(field, create_paddle(level->paddles[i].x, level->paddles[i].y,
+                                        level->paddles[i].orientation));
+    }
+    
+    for (i = 0; i < level->num_balls; i++) {
+        add_ball(field, create_ball(level->balls[i].x, level->balls[i].y,
+                                    cap_angle(level->balls[i].angle),
+                                    next_random_number(&field->random, 0, MAX_FIELD_SEED)));
+    }
+    
+    for (i = 0; i < level->num_holes; i++) {
+        add_hole(field, create_hole(level->holes[i].x, level->holes[i].y));
+    }
+    
+    /* Load the images that aren't block types yet in parallel before building the map */
+    if (parallel) {
+        init_job_group(&images);
+        
+        for (i = 0; i < level->num_block_ids; i++) {
+            if (level->block_ids[i].count > 0 &&
+                find_block_type(level->block_ids[i].image) == NO_BLOCK_TYPE) {
+                preload_resource_image_group(&images, level->block_ids[i].image);
+            }
+        }
+        
+        /* Only wait for these images, not the other jobs */
+        wait_for_job_group(&images);
+    }
+    
+    map = create_map(level->width, level->height);
+    
+    /* A block id is a block type, or an image that becomes a plain type */
+    for (i = 0; i < level->num_block_ids; i++) {
+        block_id = &level->block_ids[i];
+        types[i] = NO_BLOCK_TYPE;
+        
+        if (block_id->count > 0) {
+            types[i] = use_block_type(map, block_id->image);
+        }
+    }
+    
+    for (i = 0; i < level->width * level->height; i++) {
+        cell = &level->cells[i];
+        
+        if (cell->block != NO_LEVEL_BLOCK) {
+            set_block(map, i % level->width, i / level->width, types[cell->block], cell->hits);
+        }
+    }
+    
+    set_map(field, map);
+    
+    /* Start with the camera on the balls */
+    update_camera(field, 1);
+    
+    return field;
+}
+
+
+/**
+ * Load a level file and build a field out of it, see build_field.
+ * Returns NULL if the level is broken.
+ */
+FIELD *load_level_field(const char *filename, int parallel, unsigned long seed)
+{
+    LEVEL *level = NULL;
+    FIELD *field = NULL;
+    
+    level = load_level(filename);
+    
+    if (level) {
+        field = build_field(level, parallel, seed);
+        destroy_level(level);
+    }
+    
+    return field;
+}
+
+
+/**
+ * Make a field that keeps going up for as long as the player lasts.
+ */
+FIELD *create_endless_field()
+{
+    ENDLESS *endless = NULL;
+    FIELD *field = NULL;
+    MAP *map = NULL;
+    CHUNK *chunk = NULL;
+    RECT view;
+    int i = 0;
+    
+    field = create_field();
+    
+    endless = alloc_memory("ENDLESS", sizeof(ENDLESS));
+    endless->seed = random_number(0, MAX_FIELD_SEED);
+    endless->next_chunk = 0;
+    endless->pending = NULL;
+    init_job_group(&endless->jobs);
+    field->endless = endless;
+    seed_random_state(&field->random, endless->seed);
+    
+    map = create_map(ENDLESS_WIDTH, MAX_CHUNKS * CHUNK_ROWS);
+    
+    /* Use the block types of these images, or plain blocks if there aren't any */
+    for (i = 0; i < NUM_ENDLESS_BLOCKS; i++) {
+        endless->types[i] = use_block_type(map, endless_block_images[i]);
+    }
+    
+    set_map(field, map);
+    
+    /* Fill the map right away, the first chunk ends up at the bottom */
+    for (i = 0; i < MAX_CHUNKS; i++) {
+        chunk = create_chunk(endless);
+        generate_chunk(chunk);
+        attach_chunk(field, chunk);
+        destroy_chunk(chunk);
+    }
+    
+    /* Start at the bottom of the map */
+    field_view(field, &view);
+    field->camera_x = 0;
+    field->camera_y = field_height(field) - view.h;
+    
+    add_paddle(field, create_paddle(field_width(field) / 2,
+                                    field_height(field) - ENDLESS_PADDLE_MARGIN, 'H'));
+    add_ball(field, create_ball(field_width(field) / 2,
+                                field_height(field) - ENDLESS_PADDLE_MARGIN * 3, 45,
+                                next_random_number(&field->random, 0, MAX_FIELD_SEED)));
+    
+    endless->pending = start_chunk(endless);
+    
+    return field;
+}
+
+
+/**
+ * Scroll an endless field, and swap the bottom chunk for the
+ * next one once it's out of sight. The paddles stay in the same
+ * place on the screen, and balls that fall off it are lost.
+ */
+void update_endless(FIELD *field)
+{
+    ENDLESS *endless = field->endless;
+    RECT view;
+    float dy = 0;
+    int i = 0;
+    
+    field_view(field, &view);
+    
+    if (view.y + view.h <= field_height(field) - (CHUNK_ROWS * BLOCK_SIZE) &&
+        is_chunk_done(endless->pending)) {
+        attach_chunk(field, endless->pending);
+        destroy_chunk(endless->pending);
+        endless->pending = start_chunk(endless);
+        field_view(field, &view);
+    }
+    
+    /* Wait at the top if the next chunk isn't ready yet */
+    dy = field->camera_y < ENDLESS_SCROLL_SPEED ? field->camera_y : ENDLESS_SCROLL_SPEED;
+    field->camera_y -= dy;
+    
+    for (i = 0; i < field->num_paddles; i++) {
+        field->paddles[i]->body.y -= dy;
+    }
+    field->default_ball_y -= dy;
+    
+    for (i = 0; i < MAX_BALLS; i++) {
+        if (field->balls[i] && north_edge(field->balls[i]->body.y, &(field->balls[i]->body.box)) > field->camera_y + view.h) {
+            field->balls[i]->dead = 1;
+        }
+    }
+    
+    for (i = 0; i < MAX_POWERUPS; i++) {
+        if (field->powerups[i] && north_edge(field->powerups[i]->body.y, &(field->powerups[i]->body.box)) > field->camera_y + view.h) {
+            destroy_powerup(remove_powerup(field, field->powerups[i]));
+        }
+    }
+    
+    if (dy > 0) {
+        request_redraw();
+    }
+}
+
+
+/**
+ * The job that loads a level on a worker thread.
+ */
+void load_level_job(void *data)
+{
+    LEVEL_LOAD *load = (LEVEL_LOAD *)data;
+    FIELD *field = NULL;
+    
+    field = load_level_field(load->filename, 0, load->seed);
+    
+    al_lock_mutex(load->mutex);
+    load->field = field;
+    load->done = 1;
+    al_broadcast_cond(load->cond);
+    al_unlock_mutex(load->mutex);
+}
+
+
+/**
+ * Start loading a level in the background. The ready function
+ * is called with the data once the level is loaded, the next
+ * time poll_level_load or wait_for_level_load is called.
+ */
+LEVEL_LOAD *start_level_load(const char *filename, void (*ready)(LEVEL_LOAD *load, void *data), void *data)
+{
+    LEVEL_LOAD *load = alloc_memory("LEVEL LOAD", sizeof(LEVEL_LOAD));
+    
+    strncpy(load->filename, filename, STRING_LENGTH - 1);
+    load->filename[STRING_LENGTH - 1] = '\0';
+    load->seed = random_number(0, MAX_FIELD_SEED);
+    load->field = NULL;
+    load->ready = ready;
+    load->data = data;
+    load->done = 0;
+    load->reported = 0;
+    load->mutex = al_create_mutex();
+    load->cond = al_create_cond();
+    
+    init_job_group(&load->jobs);
+    add_group_job(&load->jobs, load_level_job, load);
+    
+    return load;
+}
+
+
+/**
+ * Returns true if the level is done loading, and calls the ready
+ * function the first time it is. Only call this from the game thread.
+ */
+int poll_level_load(LEVEL_LOAD *load)
+{
+    int done = 0;
+    
+    al_lock_mutex(load->mutex);
+    done = load->done;
+    al_unlock_mutex(load->mutex);
+    
+    if (done && !load->reported) {
+        load->reported = 1;
+        
+        if (load->ready) {
+            load->ready(load, load->data);
+        }
+    }
+    
+    return done;
+}
+
+
+/**
+ * Wait until the level is done loading.
+ */
+void wait_for_level_load(LEVEL_LOAD *load)
+{
+    al_lock_mutex(load->mutex);
+    while (!load->done) {
+        al_wait_cond(load->cond, load->mutex);
+    }
+    al_unlock_mutex(load->mutex);
+    
+    poll_level_load(load);
+}
+
+
+/**
+ * Take the field out of a level that is done loading.
+ */
+FIELD *take_level_field(LEVEL_LOAD *load)
+{
+    FIELD *field = NULL;
+    
+    wait_for_level_load(load);
+    
+    field = load->field;
+    load->field = NULL;
+    
+    return field;
+}
+
+
+/**
+ * Free a level load. If it hasn't started loading, it never will,
+ * and if it's loading, this waits for it. The field is destroyed
+ * too, unless it was taken.
+ */
+void destroy_level_load(LEVEL_LOAD *load)
+{
+    if (!load) {
+        return;
+    }
+    
+    cancel_job_group(&load->jobs);
+    
+    destroy_field(load->field);
+    al_destroy_cond(load->cond);
+    al_destroy_mutex(load->mutex);
+    
+    free_memory("LEVEL LOAD", load);
+}
+
+
+/**
+ * Add a level to the list, unless it's already there.
+ */
+void add_level_filename(const char *filename)
+{
+    int i = 0;
+    
+    for (i = 0; i < num_levels; i++) {
+        if (strcmp(level_filenames[i], filename) == 0) {
+            return;
+        }
+    }
+    
+    if (num_levels >= MAX_LEVELS) {
+        fprintf(stderr, "Too many levels, skipping \"%s\".\n", filename);
+        fprintf(stderr, "Please increase MAX_LEVELS.\n");
+        return;
+    }
+    
+    strncpy(level_filenames[num_levels], filename, STRING_LENGTH - 1);
+    level_filenames[num_levels][STRING_LENGTH - 1] = '\0';
+    num_levels++;
+}
+
+
+/**
+ * Returns true if the name of a file in LEVELS_DIRECTORY,
+ * without the directory, is a level.
+ */
+int is_level_name(const char *name)
+{
+    int length = strlen(name);
+    int extension = strlen(LEVEL_EXTENSION);
+    
+    return length > extension && strcmp(name + length - extension, LEVEL_EXTENSION) == 0;
+}
+
+
+int compare_level_filenames(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+
+/**
+ * Find every level in LEVELS_DIRECTORY, in the archive and on the
+ * disk, and play them in order of their names. Only the names are
+ * read, so this is fast even with hundreds of levels.
+ */
+void find_levels()
+{
+    ALLEGRO_FS_ENTRY *directory = NULL;
+    ALLEGRO_FS_ENTRY *entry = NULL;
+    char filename[STRING_LENGTH];
+    const char *name = NULL;
+    int prefix = strlen(LEVELS_DIRECTORY);
+    int i = 0;
+    
+    num_levels = 0;
+    
+    for (i = 0; i < count_archive_files(); i++) {
+        archive_file_name(i, filename, STRING_LENGTH);
+        
+        if (strncmp(filename, LEVELS_DIRECTORY, prefix) == 0 &&
+            strchr(filename + prefix, '/') == NULL && is_level_name(filename + prefix)) {
+            add_level_filename(filename);
+        }
+    }
+    
+    directory = al_create_fs_entry(LEVELS_DIRECTORY);
+    
+    if (directory && al_open_directory(directory)) {
+        while ((entry = al_read_directory(directory)) != NULL) {
+            
+            /* Keep the name the way it's written in the rest of the game */
+            name = strrchr(al_get_fs_entry_name(entry), '/');
+            name = name ? name + 1 : al_get_fs_entry_name(entry);
+            
+            if (!(al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISDIR) && is_level_name(name) &&
+                prefix + strlen(name) < STRING_LENGTH) {
+                sprintf(filename, "%s%s", LEVELS_DIRECTORY, name);
+                add_level_filename(filename);
+            }
+            
+            al_destroy_fs_entry(entry);
+        }
+        
+        al_close_directory(directory);
+    }
+    
+    al_destroy_fs_entry(directory);
+    
+    qsort(level_filenames, num_levels, STRING_LENGTH, compare_level_filenames);
+}
+
+
+/**
+ * Keep the next level when it's done loading.
+ */
+void next_level_ready(LEVEL_LOAD *load, void *data)
+{
+    GAME *game = (GAME *)data;
+    
+    game->next_field = take_level_field(load);
+}
+
+
+/**
+ * Start loading the level after the one being played.
+ */
+void preload_next_level(GAME *game)
+{
+    if (game->level + 1 < num_levels) {
+        game->next_level = start_level_load(level_filenames[game->level + 1], next_level_ready, game);
+    }
+}
+
+
+/**
+ * Switch to the next level. Returns false if there
+ * are no more levels.
+ */
+int go_to_next_level(GAME *game)
+{
+    /* It should be done by now, but it might not be */
+    if (game->next_level) {
+        wait_for_level_load(game->next_level);
+        destroy_level_load(game->next_level);
+        game->next_level = NULL;
+    }
+    
+    if (!game->next_field) {
+        return 0;
+    }
+    
+    destroy_field(game->field);
+    game->field = game->next_field;
+    game->next_field = NULL;
+    game->level++;
+    
+    preload_next_level(game);
+    
+    request_redraw();
+    
+    return 1;
+}
+
+
+/**
+ * In dev mode, load images again when their files change,
+ * and mark which levels have files that changed.
+ */
+void check_changed_files(int levels_changed[MAX_LEVELS])
+{
+    char filename[STRING_LENGTH];
+    int i = 0;
+    
+    for (i = 0; i < num_levels; i++) {
+        levels_changed[i] = 0;
+    }
+    
+    if (!dev_mode) {
+        return;
+    }
+    
+    while (next_changed_file(filename, STRING_LENGTH)) {
+        for (i = 0; i < num_levels; i++) {
+            if (strcmp(filename, level_filenames[i]) == 0) {
+                levels_changed[i] = 1;
+            }
+        }
+        
+        if (reload_resource_image(filename)) {
+            printf("Reloaded \"%s\".\n", filename);
+            request_redraw();
+        }
+    }
+}
+
+
+/**
+ * In dev mode, rebuild the field when the level being played
+ * changes, and start loading the next level again when it changes.
+ */
+void reload_changed_levels(GAME *game)
+{
+    int levels_changed[MAX_LEVELS];
+    FIELD *field = NULL;
+    
+    check_changed_files(levels_changed);
+    
+    if (levels_changed[game->level]) {
+        field = load_level_field(level_filenames[game->level], 1, random_number(0, MAX_FIELD_SEED));
+        
+        /* Keep playing the old field if the new one is broken */
+        if (field) {
+            destroy_field(game->field);
+            game->field = field;
+            printf("Reloaded \"%s\".\n", level_filenames[game->level]);
+            request_redraw();
+        } else {
+            fprintf(stderr, "Failed to reload level \"%s\".\n", level_filenames[game->level]);
+        }
+    }
+    
+    if (game->level + 1 < num_levels && levels_changed[game->level + 1]) {
+        destroy_level_load(game->next_level);
+        game->next_level = NULL;
+        destroy_field(game->next_field);
+        game->next_field = NULL;
+        
+        preload_next_level(game);
+    }
+}
+
+
+int update_game(void *data)
+{
+    GAME *game = (GAME *)data;
+    
+    if (game->field->endless) {
+        update_endless(game->field);
+    } else {
+        reload_changed_levels(game);
+    }
+    
+    update_field(game->field, game);
+    
+    /* Check on the next level */
+    if (game->next_level && poll_level_load(game->next_level)) {
+        destroy_level_load(game->next_level);
+        game->next_level = NULL;
+    }
+    
+    /* An endless game goes until the player runs out of lives */
+    if (game->field->endless && game->player->lives <= 0) {
+        return 0;
+    }
+    
+    /* All of the blocks are gone, go to the next level */
+    if (!game->field->endless && game->field->map && is_map_clear(game->field->map)) {
+        if (!go_to_next_level(game)) {
+            return 0;
+        }
+    }
+    
+    /* Press P to pause */
+    if (is_key_pressed(ALLEGRO_KEY_P)) {
+        pause_game();
+    }
+    
+    /* Press escape to quit */
+    if (is_key_pressed(ALLEGRO_KEY_ESCAPE)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+
+void get_desktop_resolution(int adapter, int *w, int *h)
+{
+    /*
+       ALLEGRO_MONITOR_INFO info;
+
+       al_get_monitor_info(adapter, &info);
+
+       *w = info.x2 - info.x1;
+       *h = info.y2 - info.y1;
+     */
+    *w = 1680;
+    *h = 1050;
+}
+
+
+/**
+ * The render thread. It owns the display, and draws
+ * every snapshot that the game sends it.
+ */
+void *render(ALLEGRO_THREAD *thread, void *data)
+{
+    SNAPSHOT *snapshot = NULL;
+    double start = 0;
+    
+    al_set_target_backbuffer(display);
+    
+    while ((snapshot = read_snapshot(snapshots)) != NULL) {
+        
+        /* Move images loaded by the game thread into video memory */
+        convert_resources();
+        
+        /* Draw */
+        start = al_get_time();
+        snapshot->draw(snapshot);
+        governor_frame_time(al_get_time() - start);
+        
+        /* Update the screen */
+        al_flip_display();
+        
+        /* Throw out old images if they're using too much memory */
+        trim_resources(consumed_snapshot(snapshots));
+    }
+    
+    /* Give the display back */
+    al_set_target_bitmap(NULL);
+    
+    return NULL;
+}
+
+
+/**
+ * Update until the update function returns false.
+ * After an update, the snap function fills in a snapshot that is
+ * handed to the render thread to draw. A snapshot is only sent when
+ * something asks for it with request_redraw, so a screen that isn't
+ * changing doesn't cost anything to show.
+ *
+ * A menu is updated by the slower menu timer, and right away when a
+ * key is pressed, so it barely wakes up while nobody touches it.
+ */
+void run_screen(int (*update)(void *data), void (*snap)(void *data, SNAPSHOT *snapshot),
+                void *data, int menu)
+{
+    int keep_running = 1;
+    double start = 0;
+    
+    ALLEGRO_EVENT_QUEUE *events = al_create_event_queue();
+    ALLEGRO_EVENT event;
+    
+    al_register_event_source(events, al_get_timer_event_source(menu ? menu_timer : timer));
+    al_register_event_source(events, al_get_keyboard_event_source());
+    al_register_event_source(events, al_get_display_event_source(display));
+    
+    /* Always draw the first frame */
+    request_redraw();
+    
+    while (keep_running) {
+        al_wait_for_event(events, &event);
+
+        if (event.type == ALLEGRO_EVENT_TIMER ||
+            (menu && event.type == ALLEGRO_EVENT_KEY_DOWN)) {
+            
+            /* Ignore ticks that were already queued when pausing */
+            if (paused) {
+                continue;
+            }
+            
+            /* Images released during this update could be in the last snapshot */
+            set_resource_stamp(snapshot_seq(snapshots));
+            
+            /* Update */
+            start = al_get_time();
+            keep_running = update(data);
+            governor_tick_time(al_get_time() - start);
+            
+            /* Play the sounds from this update */
+            flush_sounds();
+            
+            /* Adjust the drawing quality to keep up the frame rate */
+            update_governor();
+            
+        } else if (event.type == ALLEGRO_EVENT_KEY_DOWN) {
+            
+            /* The timer is stopped, so unpausing has to happen here */
+            if (paused && event.keyboard.keycode == ALLEGRO_KEY_P) {
+                resume_game();
+            }
+            
+        } else if (event.type == ALLEGRO_EVENT_DISPLAY_EXPOSE ||
+                   event.type == ALLEGRO_EVENT_DISPLAY_SWITCH_IN) {
+            
+            /* The window needs to be repainted */
+            request_redraw();
+        }
+
+        if (redraw_requested && al_is_event_queue_empty(events)) {
+            
+            /* Try again on the next update */
+            if (!paused && governor_skip_frame()) {
+                continue;
+            }
+            
+            redraw_requested = 0;
+            
+            /* Send the render thread something new to draw */
+            snap(data, write_snapshot(snapshots));
+            publish_snapshot(snapshots);
+        }
+    }
+    
+    al_destroy_event_queue(events);
+}
+
+
+/**
+ * Run a screen that plays the game, see run_screen.
+ */
+void run(int (*update)(void *data), void (*snap)(void *data, SNAPSHOT *snapshot), void *data)
+{
+    run_screen(update, snap, data, 0);
+}
+
+
+/**
+ * Run a menu screen, see run_screen.
+ */
+void run_menu(int (*update)(void *data), void (*snap)(void *data, SNAPSHOT *snapshot), void *data)
+{
+    run_screen(update, snap, data, 1);
+}
+
+
+/**
+ * Play a level that is loading, and then the levels after it.
+ */
+void play_levels(LEVEL_LOAD *load, int level)
+{
+    GAME *game = NULL;
+    
+    /**
+     * Initialize new game data to play
+     */
+    
+    game = create_game();
+    game->player = create_player();
+    game->field = take_level_field(load);
+    game->level = level;
+    
+    game->mousescale = 1; /* / (float)scale;*/
+    
+    if (game->field) {
+        preload_next_level(game);
+        run(update_game, snap_game, game);
+    }
+    
+    /* Done playing, destroy the game */
+    destroy_level_load(game->next_level);
+    game->next_level = NULL;
+    destroy_game(game);
+}
+
+
+/**
+ * The job that gets a thumbnail ready on a worker thread.
+ */
+void load_thumb_job(void *data)
+{
+    LEVEL_THUMB *thumb = (LEVEL_THUMB *)data;
+    ALLEGRO_BITMAP *bitmap = NULL;
+    char filename[THUMB_FILENAME_SIZE];
+    unsigned long generation = 0;
+    
+    al_lock_mutex(thumb->mutex);
+    generation = thumb->generation;
+    al_unlock_mutex(thumb->mutex);
+    
+    if (cache_level_thumb(level_filenames[thumb->level], filename, THUMB_FILENAME_SIZE)) {
+        bitmap = acquire_resource_image(filename);
+    }
+    
+    al_lock_mutex(thumb->mutex);
+    thumb->bitmap = bitmap;
+    thumb->loaded = generation;
+    thumb->done = 1;
+    al_unlock_mutex(thumb->mutex);
+}
+
+
+/**
+ * Check if a thumbnail that is loading is done. If the level
+ * changed while it was loading, it's thrown out, so it's loaded
+ * again. Only call this from the game thread.
+ */
+void check_thumb(LEVEL_THUMB *thumb)
+{
+    if (thumb->state == THUMB_LOADING) {
+        al_lock_mutex(thumb->mutex);
+        if (thumb->done && thumb->loaded == thumb->generation) {
+            thumb->state = THUMB_LOADED;
+        } else if (thumb->done) {
+            release_resource_image(thumb->bitmap);
+            thumb->bitmap = NULL;
+            thumb->done = 0;
+            thumb->state = THUMB_UNLOADED;
+        }
+        al_unlock_mutex(thumb->mutex);
+    }
+}
+
+
+/**
+ * Let go of a thumbnail that is done loading, so it's
+ * loaded again the next time it's needed.
+ */
+void unload_thumb(LEVEL_THUMB *thumb)
+{
+    if (thumb->state == THUMB_LOADED) {
+        if (thumb->bitmap) {
+            release_resource_image(thumb->bitmap);
+        }
+        
+        thumb->bitmap = NULL;
+        thumb->state = THUMB_UNLOADED;
+        thumb->shown = 0;
+        thumb->done = 0;
+    }
+}
+
+
+/**
+ * Forget a thumbnail because its level changed, even if
+ * it's still loading. Only call this from the game thread.
+ */
+void change_thumb(LEVEL_THUMB *thumb)
+{
+    al_lock_mutex(thumb->mutex);
+    thumb->generation++;
+    al_unlock_mutex(thumb->mutex);
+    
+    check_thumb(thumb);
+    unload_thumb(thumb);
+}
+
+
+LEVEL_SELECT *create_level_select()
+{
+    LEVEL_SELECT *select = NULL;
+    LEVEL_THUMB *thumb = NULL;
+    int i = 0;
+    
+    select = alloc_memory("LEVEL SELECT", sizeof(LEVEL_SELECT));
+    
+    select->mutex = al_create_mutex();
+    select->selected = 0;
+    select->top_row = 0;
+    select->load = NULL;
+    select->load_level = 0;
+    init_job_group(&select->thumb_jobs);
+    
+    for (i = 0; i < num_levels; i++) {
+        thumb = &select->thumbs[i];
+        thumb->level = i;
+        thumb->state = THUMB_UNLOADED;
+        thumb->bitmap = NULL;
+        thumb->shown = 0;
+        thumb->generation = 0;
+        thumb->done = 0;
+        thumb->loaded = 0;
+        thumb->mutex = select->mutex;
+    }
+    
+    return select;
+}
+
+
+void destroy_level_select(LEVEL_SELECT *select)
+{
+    int i = 0;
+    
+    if (!select) {
+        return;
+    }
+    
+    /* Forget the thumbnails that haven't started loading */
+    cancel_job_group(&select->thumb_jobs);
+    
+    for (i = 0; i < num_levels; i++) {
+        check_thumb(&select->thumbs[i]);
+        unload_thumb(&select->thumbs[i]);
+    }
+    
+    destroy_level_load(select->load);
+    al_destroy_mutex(select->mutex);
+    
+    free_memory("LEVEL SELECT", select);
+}
+
+
+/**
+ * Start loading the thumbnails on and near the screen,
+ * and let go of the ones that are far away.
+ */
+void update_thumbs(LEVEL_SELECT *select)
+{
+    LEVEL_THUMB *thumb = NULL;
+    int first = (select->top_row - SELECT_KEEP_ROWS) * SELECT_COLUMNS;
+    int last = (select->top_row + SELECT_ROWS + SELECT_KEEP_ROWS) * SELECT_COLUMNS;
+    int i = 0;
+    
+    for (i = 0; i < num_levels; i++) {
+        thumb = &select->thumbs[i];
+        
+        check_thumb(thumb);
+        
+        if (i < first || i >= last) {
+            unload_thumb(thumb);
+        } else if (thumb->state == THUMB_UNLOADED) {
+            thumb->state = THUMB_LOADING;
+            add_group_job(&select->thumb_jobs, load_thumb_job, thumb);
+        } else if (thumb->state == THUMB_LOADED && !thumb->shown) {
+            thumb->shown = 1;
+            request_redraw();
+        }
+    }
+}
+
+
+int update_level_select(void *data)
+{
+    LEVEL_SELECT *select = (LEVEL_SELECT *)data;
+    int levels_changed[MAX_LEVELS];
+    int selected = select->selected;
+    int i = 0;
+    
+    if (num_levels == 0) {
+        return 0;
+    }
+    
+    /* Draw the thumbnails of levels that changed again */
+    check_changed_files(levels_changed);
+    
+    for (i = 0; i < num_levels; i++) {
+        if (levels_changed[i]) {
+            change_thumb(&select->thumbs[i]);
+        }
+    }
+    
+    if (select->load && levels_changed[select->load_level]) {
+        destroy_level_load(select->load);
+        select->load = NULL;
+    }
+    
+    /* Move around with the arrow keys */
+    if (is_key_pressed(ALLEGRO_KEY_LEFT)) {
+        selected--;
+    }
+    if (is_key_pressed(ALLEGRO_KEY_RIGHT)) {
+        selected++;
+    }
+    if (is_key_pressed(ALLEGRO_KEY_UP)) {
+        selected -= SELECT_COLUMNS;
+    }
+    if (is_key_pressed(ALLEGRO_KEY_DOWN)) {
+        selected += SELECT_COLUMNS;
+    }
+    if (is_key_pressed(ALLEGRO_KEY_PGUP)) {
+        selected -= MAX_SHOWN_THUMBS;
+    }
+    if (is_key_pressed(ALLEGRO_KEY_PGDN)) {
+        selected += MAX_SHOWN_THUMBS;
+    }
+    
+    if (selected < 0) {
+        selected = 0;
+    }
+    if (selected >= num_levels) {
+        selected = num_levels - 1;
+    }
+    
+    if (selected != select->selected) {
+        select->selected = selected;
+        
+        /* Scroll to keep the selected level on the screen */
+        if (selected / SELECT_COLUMNS < select->top_row) {
+            select->top_row = selected / SELECT_COLUMNS;
+        } else if (selected / SELECT_COLUMNS >= select->top_row + SELECT_ROWS) {
+            select->top_row = selected / SELECT_COLUMNS - SELECT_ROWS + 1;
+        }
+        
+        request_redraw();
+    }
+    
+    update_thumbs(select);
+    
+    /* Load the selected level while the player looks at it, once the last one is done */
+    if (select->load && select->load_level != select->selected && poll_level_load(select->load)) {
+        destroy_level_load(select->load);
+        select->load = NULL;
+    }
+    
+    if (!select->load) {
+        select->load = start_level_load(level_filenames[select->selected], NULL, NULL);
+        select->load_level = select->selected;
+    }
+    
+    if (is_key_pressed(ALLEGRO_KEY_ENTER) || is_key_pressed(ALLEGRO_KEY_SPACE)) {
+        if (select->load_level != select->selected) {
+            destroy_level_load(select->load);
+            select->load = start_level_load(level_filenames[select->selected], NULL, NULL);
+            select->load_level = select->selected;
+        }
+        
+        play_levels(select->load, select->load_level);
+        
+        destroy_level_load(select->load);
+        select->load = NULL;
+        
+        /* Show the level select screen again */
+        request_redraw();
+    }
+    
+    /* Press escape to go back to the title screen */
+    if (is_key_pressed(ALLEGRO_KEY_ESCAPE)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+
+void draw_level_select(SNAPSHOT *snapshot)
+{
+    ALLEGRO_COLOR dim = al_map_rgb_f(0.5, 0.5, 0.5);
+    int width = SELECT_COLUMNS * THUMB_W + (SELECT_COLUMNS - 1) * SELECT_SPACING;
+    int height = SELECT_ROWS * THUMB_H + (SELECT_ROWS - 1) * SELECT_SPACING;
+    int x = 0;
+    int y = 0;
+    int i = 0;
+    
+    draw_wallpaper();
+    
+    for (i = 0; i < snapshot->num_thumbs; i++) {
+        if (!snapshot->thumbs[i]) {
+            continue;
+        }
+        
+        x = (CANVAS_W - width) / 2 + (i % SELECT_COLUMNS) * (THUMB_W + SELECT_SPACING);
+        y = (CANVAS_H - height) / 2 + (i / SELECT_COLUMNS) * (THUMB_H + SELECT_SPACING);
+        
+        /* Darken every level but the selected one */
+        if (i == snapshot->selected_thumb) {
+            al_draw_bitmap(snapshot->thumbs[i], x, y, 0);
+        } else {
+            al_draw_tinted_bitmap(snapshot->thumbs[i], dim, x, y, 0);
+        }
+    }
+}
+
+
+void snap_level_select(void *data, SNAPSHOT *snapshot)
+{
+    LEVEL_SELECT *select = (LEVEL_SELECT *)data;
+    LEVEL_THUMB *thumb = NULL;
+    int first = select->top_row * SELECT_COLUMNS;
+    int i = 0;
+    
+    snapshot->draw = draw_level_select;
+    snapshot->paused = 0;
+    snapshot->num_thumbs = 0;
+    snapshot->selected_thumb = select->selected - first;
+    
+    for (i = first; i < num_levels && i < first + MAX_SHOWN_THUMBS; i++) {
+        thumb = &select->thumbs[i];
+        snapshot->thumbs[snapshot->num_thumbs++] = (thumb->state == THUMB_LOADED) ? thumb->bitmap : NULL;
+    }
+}
+
+
+int update_title_screen(void *data)
+{
+    LEVEL_SELECT *select = NULL;
+    GAME *game = NULL;
+    int levels_changed[MAX_LEVELS];
+    
+    /* Load images again if they changed */
+    check_changed_files(levels_changed);
+
+    /* Pick a level to play */
+    if (is_key_pressed(ALLEGRO_KEY_ENTER) || is_key_pressed(ALLEGRO_KEY_SPACE)) {
+        select = create_level_select();
+        
+        run_menu(update_level_select, snap_level_select, select);
+        
+        destroy_level_select(select);
+        select = NULL;
+        
+        /* Show the title screen again */
+        request_redraw();
+    }
+    
+    /* Press E for a field that never ends */
+    if (is_key_pressed(ALLEGRO_KEY_E)) {
+        game = create_game();
+        game->player = create_player();
+        game->field = create_endless_field();
+        game->mousescale = 1;
+        
+        run(update_game, snap_game, game);
+        
+        destroy_game(game);
+        game = NULL;
+        
+        request_redraw();
+    }
+    
+    /* Press escape to quit */
+    if (is_key_pressed(ALLEGRO_KEY_ESCAPE)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+
+/**
+ * The blocks behind the title. They're picked on the game
+ * thread, since the render thread can't use the shared random
+ * numbers or load images.
+ */
+typedef struct TITLE_SCREEN {
+    ALLEGRO_BITMAP *blocks[NUM_ENDLESS_BLOCKS];
+    unsigned long seed;
+} TITLE_SCREEN;
+
+
+TITLE_SCREEN *create_title_screen()
+{
+    TITLE_SCREEN *title = alloc_memory("TITLE SCREEN", sizeof(TITLE_SCREEN));
+    int i = 0;
+    
+    for (i = 0; i < NUM_ENDLESS_BLOCKS; i++) {
+        title->blocks[i] = acquire_resource_image(endless_block_images[i]);
+    }
+    
+    title->seed = random_number(0, MAX_FIELD_SEED);
+    
+    return title;
+}
+
+
+void destroy_title_screen(TITLE_SCREEN *title)
+{
+    int i = 0;
+    
+    if (!title) {
+        return;
+    }
+    
+    for (i = 0; i < NUM_ENDLESS_BLOCKS; i++) {
+        release_resource_image(title->blocks[i]);
+    }
+    
+    free_memory("TITLE SCREEN", title);
+}
+
+
+void draw_title_screen(SNAPSHOT *snapshot)
+{
+    static RESOURCE_HANDLE handle = NO_RESOURCE;
+    static ALLEGRO_BITMAP *background = NULL;
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    ALLEGRO_BITMAP *title = NULL;
+    ALLEGRO_BITMAP *block = NULL;
+    RANDOM random;
+
+    int x = 0;
+    int y = 0;
+
+    if (handle == NO_RESOURCE) {
+        handle = find_resource_handle("title.bmp");
+    }
+    title = resource_handle_image(handle);
+    
+    if (!background) {
+        background = al_create_bitmap(CANVAS_W, CANVAS_H);
+        al_set_target_bitmap(background);
+        seed_random_state(&random, snapshot->title_seed);
+        for (y = 0; y < CANVAS_H; y += BLOCK_SIZE) {
+            for (x = 0; x < CANVAS_W; x += BLOCK_SIZE) {
+                block = snapshot->title_blocks[next_random_number(&random, 0, NUM_ENDLESS_BLOCKS - 1)];
+                if (block) {
+                    al_draw_bitmap(block, x, y, 0);
+                }
+            }
+        }
+        al_set_target_bitmap(target);
+    }
+    
+    al_draw_bitmap(background, 0, 0, 0);
+    
+    /* Draw the title screen centered on the canvas */
+    x = (CANVAS_W - al_get_bitmap_width(title)) / 2;
+    y = (CANVAS_H - al_get_bitmap_height(title)) / 2;
+    al_draw_bitmap(title, x, y, 0);
+}
+
+
+void snap_title_screen(void *data, SNAPSHOT *snapshot)
+{
+    TITLE_SCREEN *title = (TITLE_SCREEN *)data;
+    int i = 0;
+    
+    snapshot->draw = draw_title_screen;
+    snapshot->paused = 0;
     
-    /* Y position */
-    if (fscanf(file, "%d", &y) != 1) {
-        fprintf(stderr, "Failed to load paddle y position.\n");
-        return NULL;
+    for (i = 0; i < NUM_ENDLESS_BLOCKS; i++) {
+        snapshot->title_blocks[i] = title->blocks[i];
     }
+    snapshot->title_seed = title->seed;
+}
+
+
+/**
+ * Load a game to use in a benchmark or test.
+ */
+GAME *load_headless_game(const char *filename)
+{
+    GAME *game = NULL;
     
-    /* Orientation */
-    if (fscanf(file, CHAR_FORMAT_SKIP_WHITESPACE, &orientation) != 1) {
-        fprintf(stderr, "Failed to load paddle orientation.\n");
-        return NULL;
-    }
+    game = create_game();
+    game->player = create_player();
+    game->field = load_level_field(filename, 1, random_number(0, MAX_FIELD_SEED));
     
-    if (orientation != 'H' && orientation != 'V') {
-        fprintf(stderr, "Failed to read invalid paddle orientation value.\n");
+    if (!game->field) {
+        destroy_game(game);
         return NULL;
     }
     
-    return create_paddle(x, y, orientation);
+    return game;
 }
 
 
-HOLE *load_hole(FILE *file)
+/**
+ * Play a game for a number of frames without a display, drawing
+ * each frame onto the screen bitmap. Nobody touches the controls.
+ */
+void play_headless_game(GAME *game, ALLEGRO_BITMAP *screen, int frames)
 {
-    int x = 0;
-    int y = 0;
-    
-    /* X position */
-    if (fscanf(file, "%d", &x) != 1) {
-        fprintf(stderr, "Failed to load hole x position.\n");
-        return NULL;
-    }
+    SNAPSHOT *snapshot = NULL;
+    int i = 0;
     
-    /* Y position */
-    if (fscanf(file, "%d", &y) != 1) {
-        fprintf(stderr, "Failed to load hole y position.\n");
-        return NULL;
+    for (i = 0; i < frames; i++) {
+        set_resource_stamp(snapshot_seq(snapshots));
+        update_field(game->field, game);
+        
+        /* The game and the "render thread" are the same thread here */
+        snap_game(game, write_snapshot(snapshots));
+        publish_snapshot(snapshots);
+        snapshot = read_snapshot(snapshots);
+        
+        al_set_target_bitmap(screen);
+        snapshot->draw(snapshot);
+        
+        trim_resources(consumed_snapshot(snapshots));
     }
-    
-    return create_hole(x, y);
 }
 
 
-BALL *load_ball(FILE *file)
+/**
+ * Draw a level for a number of frames and print how long
+ * each layer took to draw.
+ */
+int benchmark(const char *filename, int frames)
 {
-    int x = 0;
-    int y = 0;
-    int angle = 0;
+    RESOURCE_STATS stats;
+    ALLEGRO_BITMAP *screen = NULL;
+    GAME *game = NULL;
+    double start = 0;
+    double total = 0;
+    int i = 0;
     
-    /* X position */
-    if (fscanf(file, "%d", &x) != 1) {
-        fprintf(stderr, "Failed to load ball x position.\n");
-        return NULL;
+    game = load_headless_game(filename);
+    
+    if (!game) {
+        return -1;
     }
     
-    /* Y position */
-    if (fscanf(file, "%d", &y) != 1) {
-        fprintf(stderr, "Failed to load ball y position.\n");
-        return NULL;
+    screen = al_create_bitmap(CANVAS_W, CANVAS_H);
+    
+    for (i = 0; i < NUM_LAYERS; i++) {
+        layer_times[i] = 0;
     }
     
-    /* Angle */
-    if (fscanf(file, "%d", &angle) != 1) {
-        fprintf(stderr, "Failed to load ball angle.\n");
-        return NULL;
+    profile_layers = 1;
+    start = al_get_time();
+    
+    play_headless_game(game, screen, frames);
+    
+    total = al_get_time() - start;
+    profile_layers = 0;
+    
+    printf("Played %d frames of \"%s\" in %.3f seconds.\n", frames, filename, total);
+    printf("%-12s %12s %12s\n", "LAYER", "TOTAL MS", "FRAME MS");
+    
+    for (i = 0; i < NUM_LAYERS; i++) {
+        printf("%-12s %12.3f %12.4f\n", layer_names[i],
+               layer_times[i] * MILLIS_PER_SECOND,
+               layer_times[i] * MILLIS_PER_SECOND / frames);
     }
     
-    return create_ball(x, y, cap_angle(angle));
+    get_resource_stats(&stats);
+    printf("Images: %d loaded, %ld bytes (peak %ld), %lu hits, %lu misses, %lu evictions.\n",
+           stats.count, stats.bytes, stats.peak_bytes, stats.hits, stats.misses, stats.evictions);
+    
+    al_destroy_bitmap(screen);
+    destroy_game(game);
+    
+    return 0;
 }
 
 
-typedef struct BLOCK_ID {
-    char type;
-    char bitmap_filename[STRING_LENGTH];
-} BLOCK_ID;
-
-
-#define MAX_BLOCK_IDS 24
-
-
-MAP *load_map(FILE *file, BLOCK_ID *block_ids)
+/**
+ * Count the pixels that are different between two images.
+ */
+int count_bad_pixels(ALLEGRO_BITMAP *image1, ALLEGRO_BITMAP *image2)
 {
-    MAP *map = NULL;
-    
-    int width = 0;
-    int height = 0;
-    
-    char type = 0;
-    int hits = 0;
-    ALLEGRO_BITMAP *bitmap = NULL;
-    
+    unsigned char r1, g1, b1, a1;
+    unsigned char r2, g2, b2, a2;
+    int bad = 0;
     int x = 0;
     int y = 0;
-    int i = 0;
-    
-    /* Width */
-    if (fscanf(file, "%d", &width) != 1) {
-        fprintf(stderr, "Failed to load map width.\n");
-        return NULL;
-    }
     
-    /* Y position */
-    if (fscanf(file, "%d", &height) != 1) {
-        fprintf(stderr, "Failed to load map height.\n");
-        return NULL;
+    if (al_get_bitmap_width(image1) != al_get_bitmap_width(image2) ||
+        al_get_bitmap_height(image1) != al_get_bitmap_height(image2)) {
+        
+        /* Every pixel is bad */
+        return al_get_bitmap_width(image1) * al_get_bitmap_height(image1);
     }
     
-    map = create_map(width, height);
+    al_lock_bitmap(image1, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+    al_lock_bitmap(image2, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
     
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            
-            /* Block type */
-            if (fscanf(file, CHAR_FORMAT_SKIP_WHITESPACE, &type) != 1) {
-                fprintf(stderr, "Failed to load block type.\n");
-                destroy_map(map);
-                return NULL;
-            }
-            
-            /* Block hit points */
-            if (fscanf(file, "%d", &hits) != 1) {
-                fprintf(stderr, "Failed to load block hits.\n");
-                destroy_map(map);
-                return NULL;
-            }
-            
-            if (type == '0') {
-                /* No block, empty space */
-                continue;
-            }
+    for (y = 0; y < al_get_bitmap_height(image1); y++) {
+        for (x = 0; x < al_get_bitmap_width(image1); x++) {
+            al_unmap_rgba(al_get_pixel(image1, x, y), &r1, &g1, &b1, &a1);
+            al_unmap_rgba(al_get_pixel(image2, x, y), &r2, &g2, &b2, &a2);
             
-            /* Load the bitmap from the filename */
-            for (bitmap = NULL, i = 0; i < MAX_BLOCK_IDS; i++) {
-                if (block_ids[i].type == type) {
-                    bitmap = load_resource_image(block_ids[i].bitmap_filename);
-                }
+            if (abs(r1 - r2) > GOLDEN_TOLERANCE || abs(g1 - g2) > GOLDEN_TOLERANCE ||
+                abs(b1 - b2) > GOLDEN_TOLERANCE || abs(a1 - a2) > GOLDEN_TOLERANCE) {
+                bad++;
             }
-            
-            set_block_bitmap(map, x, y, bitmap);
-            set_block_hits(map, x, y, hits);
         }
     }
     
-    return map;
+    al_unlock_bitmap(image1);
+    al_unlock_bitmap(image2);
+    
+    return bad;
 }
 
 
-FIELD *load_field(FILE *file)
+/**
+ * Draw a level and compare it to a golden image that's known to be right.
+ * If save is true, save the golden image instead.
+ */
+int golden_test(const char *filename, const char *golden_filename, int save)
 {
-    FIELD *field = NULL;
-    char line[STRING_LENGTH];
+    char actual_filename[STRING_LENGTH];
+    ALLEGRO_BITMAP *screen = NULL;
+    ALLEGRO_BITMAP *golden = NULL;
+    GAME *game = NULL;
+    int bad = 0;
+    int status = 0;
     
-    char block_id = 0;
+    game = load_headless_game(filename);
     
-    BLOCK_ID block_ids[MAX_BLOCK_IDS];
-    int num_block_ids = 0;
+    if (!game) {
+        return -1;
+    }
     
-    int i = 0;
+    screen = al_create_bitmap(CANVAS_W, CANVAS_H);
     
-    field = create_field();
-
-    for (i = 0; i < MAX_BLOCK_IDS; i++) {
-        block_ids[i].type = 0;
-        strcpy(block_ids[i].bitmap_filename, "");
-    }
+    play_headless_game(game, screen, GOLDEN_FRAMES);
     
-    /* Scan the rest of the file */
-    while (fscanf(file, "%s", line) == 1) {
+    if (save) {
+        if (!al_save_bitmap(golden_filename, screen)) {
+            fprintf(stderr, "Failed to save golden image \"%s\".\n", golden_filename);
+            status = -1;
+        }
+    } else {
+        golden = al_load_bitmap(golden_filename);
         
-        if (strcmp(line, "BALL") == 0) {
-            add_ball(field, load_ball(file));
-        } else if (strcmp(line, "HOLE") == 0) {
-            add_hole(field, load_hole(file));
-        } else if (strcmp(line, "PADDLE") == 0) {
-            add_paddle(field, load_paddle(file));
-        } else if (strcmp(line, "BLOCK") == 0) {
-            
-            /**
-             * Load block
-             */
-            
-            /* Block ID type */
-            if (fscanf(file, CHAR_FORMAT_SKIP_WHITESPACE, &block_id) != 1) {
-                fprintf(stderr, "Failed to load block ID type.\n");
-                destroy_field(field);
-                return NULL;
-            }
-            
-            /* Skip whitespace */
-            fscanf(file, "%*[ \n\t]");
+        if (!golden) {
+            fprintf(stderr, "Failed to load golden image \"%s\".\n", golden_filename);
+            status = -1;
+        } else {
+            bad = count_bad_pixels(screen, golden);
             
-            /* Block ID bitmap filename */
-            if (fgets(line, STRING_LENGTH, file) == NULL) {
-                fprintf(stderr, "Failed to load block ID filename.\n");
-                destroy_field(field);
-                return NULL;
+            if (bad > GOLDEN_MAX_BAD_PIXELS) {
+                
+                /* Save what was drawn, to see what went wrong */
+                strncpy(actual_filename, golden_filename, STRING_LENGTH - 1);
+                actual_filename[STRING_LENGTH - 1] = '\0';
+                strncat(actual_filename, ".fail.bmp", STRING_LENGTH - strlen(actual_filename) - 1);
+                al_save_bitmap(actual_filename, screen);
+                
+                printf("FAIL %s: %d pixels differ, see \"%s\".\n", filename, bad, actual_filename);
+                status = 1;
+            } else {
+                printf("PASS %s\n", filename);
             }
             
-            /* Get rid of newline */
-            line[strlen(line) - 1] = '\0';
-    
-            block_ids[num_block_ids].type = block_id;
-            strcpy(block_ids[num_block_ids].bitmap_filename, line);
-            num_block_ids++;
-            
-        } else if (strcmp(line, "MAP") == 0) {
-            set_map(field, load_map(file, block_ids));
-        } else {
-            fprintf(stderr, "Failed to load field powerup.\n");
-            destroy_field(field);
-            return NULL;
+            al_destroy_bitmap(golden);
         }
     }
     
-    return field;
-}
-
-
-void get_desktop_resolution(int adapter, int *w, int *h)
-{
-    /*
-       ALLEGRO_MONITOR_INFO info;
-
-       al_get_monitor_info(adapter, &info);
-
-       *w = info.x2 - info.x1;
-       *h = info.y2 - info.y1;
-     */
-    *w = 1680;
-    *h = 1050;
+    al_destroy_bitmap(screen);
+    destroy_game(game);
+    
+    return status;
 }
 
 
-ALLEGRO_TIMER *timer = NULL;
-
-
-void run(int (*update)(void *data), void (*draw)(void *data), void *data)
+/**
+ * Make up a level with a map of the given size, with
+ * every kind of block at random.
+ * Returns the text of the level, which has to be freed.
+ */
+char *generate_level_text(int width, int height, long *size)
 {
-    int keep_running = 1;
-    int redraw = 1;
+    static const char *cells[] = {"00", "D1", "F1", "R1", "D2", "F3"};
+    char *text = NULL;
+    char *p = NULL;
+    int x = 0;
+    int y = 0;
     
-    ALLEGRO_EVENT_QUEUE *events = al_create_event_queue();
-    ALLEGRO_EVENT event;
+    /* Every cell is 3 characters, plus room for the rest */
+    text = alloc_memory("LEVEL TEXT", (long)width * height * 3 + height + STRING_LENGTH * 2);
+    p = text;
     
-    al_register_event_source(events, al_get_timer_event_source(timer));
+    p += sprintf(p, "PADDLE 200 60 H\nPADDLE 60 200 V\nBALL 90 370 45\nHOLE 30 30\n");
+    p += sprintf(p, "BLOCK D block-daisy.bmp\nBLOCK F block-fern.bmp\nBLOCK R block-rose.bmp\n");
+    p += sprintf(p, "MAP %d %d\n", width, height);
     
-    while (keep_running) {
-        al_wait_for_event(events, &event);
-
-        if (event.type == ALLEGRO_EVENT_TIMER) {
-            
-            /* Update */
-            keep_running = update(data);
-            
-            redraw = 1;
-        }
-
-        if (redraw && al_is_event_queue_empty(events)) {
-            
-            redraw = 0;
-            
-            /* Draw */
-            draw(data);
-            
-            /* Update the screen */
-            al_flip_display();
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            memcpy(p, cells[random_number(0, 5)], 2);
+            p[2] = (x == width - 1) ? '\n' : ' ';
+            p += 3;
         }
     }
+    
+    *size = p - text;
+    
+    return text;
 }
 
 
-int update_title_screen(void *data)
+/**
+ * Parse a big made up level over and over, and print
+ * how fast levels are read.
+ */
+int benchmark_parse(int width, int height, int runs)
 {
-    GAME *game = NULL;
-    FILE *file = NULL;
-
-    if (is_key_pressed(ALLEGRO_KEY_ENTER) || is_key_pressed(ALLEGRO_KEY_SPACE)) {
-        
-        /**
-         * Initialize new game data to play
-         */
-        
-        game = create_game();
-        game->player = create_player();
-        
-        /* Load a field from a file */
-        file = fopen("data/level01.dat", "r");
-        game->field = load_field(file);
-        fclose(file);
-        
-        game->mousescale = 1; /* / (float)scale;*/
+    LEVEL *level = NULL;
+    char *text = NULL;
+    long size = 0;
+    double start = 0;
+    double total = 0;
+    int i = 0;
+    
+    if (width <= 0 || height <= 0 || width > MAX_LEVEL_SIZE || height > MAX_LEVEL_SIZE || runs <= 0) {
+        fprintf(stderr, "The map has to be 1 to %d blocks on each side.\n", MAX_LEVEL_SIZE);
+        return -1;
+    }
+    
+    text = generate_level_text(width, height, &size);
+    
+    start = al_get_time();
+    
+    for (i = 0; i < runs; i++) {
+        level = parse_level(text, size, "generated");
         
-        run(update_game, draw_game, game);
+        if (!level) {
+            free_memory("LEVEL TEXT", text);
+            return -1;
+        }
         
-        /* Done playing, destroy the game */
-        destroy_game(game);
-        game = NULL;
+        destroy_level(level);
     }
     
-    /* Press escape to quit */
-    if (is_key_pressed(ALLEGRO_KEY_ESCAPE)) {
-        return 0;
-    }
+    total = al_get_time() - start;
     
-    return 1;
+    printf("Parsed a %d x %d level (%ld bytes) %d times in %.3f seconds.\n",
+           width, height, size, runs, total);
+    printf("%.1f MB per second, %.1f million cells per second.\n",
+           size * (double)runs / total / (1024 * 1024),
+           (double)width * height * runs / total / 1000000);
+    
+    free_memory("LEVEL TEXT", text);
+    
+    return 0;
 }
 
 
-ALLEGRO_BITMAP *random_block_image()
+/**
+ * Run a benchmark or test without a display. Everything is
+ * drawn into memory bitmaps, so no window or graphics card
+ * is needed.
+ *
+ *   beeball --bench LEVEL [FRAMES]
+ *   beeball --bench-parse WIDTH HEIGHT [RUNS]
+ *   beeball --golden LEVEL IMAGE
+ *   beeball --golden-save LEVEL IMAGE
+ */
+int run_headless(int argc, char **argv)
 {
-    int num = random_number(BLOCK_EMPTY + 1, NUM_BLOCK_TYPES - 1);
+    void *slots[NUM_SNAPSHOTS];
+    SNAPSHOT *slot = NULL;
+    int frames = DEFAULT_BENCHMARK_FRAMES;
+    int status = 0;
+    int i = 0;
     
-    if (num == BLOCK_DAISY) {
-        return load_resource_image("block-daisy.bmp");
-    }
-    if (num == BLOCK_FERN) {
-        return load_resource_image("block-fern.bmp");
-    }
-    if (num == BLOCK_ROSE) {
-        return load_resource_image("block-rose.bmp");
+    if (!al_init() || !al_init_image_addon()) {
+        fprintf(stderr, "Failed to initialize allegro.\n");
+        return -1;
     }
     
-    return NULL;
-}
-
-
-void draw_title_screen(void *data)
-{
-    static ALLEGRO_BITMAP *title = NULL;
-    static ALLEGRO_BITMAP *background = NULL;
-
-    int x = 0;
-    int y = 0;
-
-    if (!title) {
-        title = load_resource_image("title.bmp");
+    /* There's no display, so keep every bitmap in memory */
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    
+    seed_random(BENCHMARK_SEED);
+    
+    init_animator(FPS);
+    init_physics(FPS);
+    init_governor(FPS);
+    init_resources();
+    add_resource_path("images/");
+    open_archive(ARCHIVE_FILENAME);
+    
+    init_workers(al_get_cpu_count());
+    preload_resource_manifest(PRELOAD_MANIFEST);
+    wait_for_jobs();
+    load_clips(CLIPS_FILENAME);
+    load_block_types(BLOCK_TYPES_FILENAME, powerup_names + POWERUP_NONE + 1, NUM_POWERUP_TYPES - 1);
+    
+    for (i = 0; i < NUM_SNAPSHOTS; i++) {
+        slot = alloc_memory("SNAPSHOT", sizeof(SNAPSHOT));
+        slot->cells = NULL;
+        slot->cells_size = 0;
+        slots[i] = slot;
     }
     
-    if (!background) {
-        background = al_create_bitmap(CANVAS_W, CANVAS_H);
-        al_set_target_bitmap(background);
-        for (y = 0; y < CANVAS_H; y += BLOCK_SIZE) {
-            for (x = 0; x < CANVAS_W; x += BLOCK_SIZE) {
-                al_draw_bitmap(random_block_image(), x, y, 0);
-            }
+    snapshots = create_snapshots(slots);
+    
+    if (strcmp(argv[1], "--bench") == 0 && argc >= 3) {
+        if (argc >= 4) {
+            frames = atoi(argv[3]);
         }
-        al_set_target_bitmap(al_get_backbuffer(display));
+        status = benchmark(argv[2], frames);
+    } else if (strcmp(argv[1], "--bench-parse") == 0 && argc >= 4) {
+        status = benchmark_parse(atoi(argv[2]), atoi(argv[3]),
+                                 argc >= 5 ? atoi(argv[4]) : DEFAULT_PARSE_BENCHMARK_RUNS);
+    } else if (strcmp(argv[1], "--golden") == 0 && argc >= 4) {
+        status = golden_test(argv[2], argv[3], 0);
+    } else if (strcmp(argv[1], "--golden-save") == 0 && argc >= 4) {
+        status = golden_test(argv[2], argv[3], 1);
+    } else {
+        fprintf(stderr, "Usage: %s --bench LEVEL [FRAMES]\n", argv[0]);
+        fprintf(stderr, "       %s --bench-parse WIDTH HEIGHT [RUNS]\n", argv[0]);
+        fprintf(stderr, "       %s --golden LEVEL IMAGE\n", argv[0]);
+        fprintf(stderr, "       %s --golden-save LEVEL IMAGE\n", argv[0]);
+        status = -1;
     }
     
-    al_draw_bitmap(background, 0, 0, 0);
+    destroy_snapshots(snapshots);
+    snapshots = NULL;
     
-    /* Draw the title screen centered on the canvas */
-    x = (CANVAS_W - al_get_bitmap_width(title)) / 2;
-    y = (CANVAS_H - al_get_bitmap_height(title)) / 2;
-    al_draw_bitmap(title, x, y, 0);
+    for (i = 0; i < NUM_SNAPSHOTS; i++) {
+        slot = slots[i];
+        free_memory("SNAPSHOT CELLS", slot->cells);
+        free_memory("SNAPSHOT", slot);
+    }
+    
+    stop_workers();
+    destroy_clips();
+    destroy_block_types();
+    stop_resources();
+    close_archive();
+    
+    check_memory();
+    
+    return status;
 }
 
 
 int main(int argc, char **argv)
 {
     ALLEGRO_EVENT_QUEUE *events = NULL;
+    
+    ALLEGRO_THREAD *render_thread = NULL;
+    void *slots[NUM_SNAPSHOTS];
+    SNAPSHOT *slot = NULL;
+    TITLE_SCREEN *title_screen = NULL;
+    int i = 0;
 
     /* For screen scaling */
     ALLEGRO_TRANSFORM trans;
@@ -2419,11 +5060,16 @@ int main(int argc, char **argv)
     int monitor_h = CANVAS_H;
     
     int status = 0;
+    
+    /* Benchmarks and tests don't need a window */
+    if (argc > 1 && strcmp(argv[1], "--dev") == 0) {
+        dev_mode = 1;
+    } else if (argc > 1) {
+        return run_headless(argc, argv);
+    }
 
     if (!al_init() || !al_init_image_addon() || !al_install_keyboard()
-        || !al_install_mouse()
-        /*|| !al_install_audio() || !al_init_acodec_addon() || !al_reserve_samples(4)*/
-	) {
+        || !al_install_mouse()) {
         fprintf(stderr, "Failed to initialize allegro.\n");
         goto catch;
     }
@@ -2431,8 +5077,9 @@ int main(int argc, char **argv)
     /*show_memory_label();*/
     
     timer = al_create_timer(1.0 / FPS);
+    menu_timer = al_create_timer(1.0 / MENU_FPS);
     
-    if (!timer) {
+    if (!timer || !menu_timer) {
         fprintf(stderr, "Failed to create timer.\n");
         goto catch;
     }
@@ -2494,32 +5141,120 @@ int main(int argc, char **argv)
     /* Initialize the physics functions */
     init_physics(FPS);
 
+    /* Initialize the drawing quality governor */
+    init_governor(FPS);
+
     /* Initialize the resource library */
     init_resources();
     add_resource_path("images/");
+    
+    if (dev_mode) {
+        
+        /* Use the loose files, and watch them for changes */
+        if (init_watch()) {
+            watch_directory("data/");
+            watch_directory("images/");
+        }
+    } else {
+        
+        /* Use the packed game files if there are any, instead of loose files */
+        open_archive(ARCHIVE_FILENAME);
+    }
+    
+    /* List the levels without loading any of them */
+    find_levels();
+    
+    /* Load the common images in parallel, so they're ready for the first frame */
+    init_workers(al_get_cpu_count());
+    preload_resource_manifest(PRELOAD_MANIFEST);
+    wait_for_jobs();
+    
+    /* Load the animations that the sprites share, and the kinds of blocks */
+    load_clips(CLIPS_FILENAME);
+    load_block_types(BLOCK_TYPES_FILENAME, powerup_names + POWERUP_NONE + 1, NUM_POWERUP_TYPES - 1);
+    
+    /* The game can be played without sound */
+    if (init_sound(DEFAULT_VOICES)) {
+        load_sounds();
+        play_music(MUSIC_FILENAME, MUSIC_GAIN);
+    }
 
     /* Set the window title and icon */
     al_set_window_title(display, "Super Bumblebee Ball");
     al_set_display_icon(display, load_resource_image("icon.bmp"));
+    
+    /* Create the snapshots that the game sends to the render thread */
+    for (i = 0; i < NUM_SNAPSHOTS; i++) {
+        slot = alloc_memory("SNAPSHOT", sizeof(SNAPSHOT));
+        slot->cells = NULL;
+        slot->cells_size = 0;
+        slots[i] = slot;
+    }
+    
+    snapshots = create_snapshots(slots);
+    
+    /* Hand the display over to the render thread */
+    al_set_target_bitmap(NULL);
+    
+    render_thread = al_create_thread(render, NULL);
+    
+    if (!render_thread) {
+        fprintf(stderr, "Failed to create render thread.\n");
+        goto catch;
+    }
+    
+    al_start_thread(render_thread);
 
     al_start_timer(timer);
+    al_start_timer(menu_timer);
 
     /* START THE GAME */
-    /*run(update_game, draw_game, game);*/
-    run(update_title_screen, draw_title_screen, NULL);
+    title_screen = create_title_screen();
+    run_menu(update_title_screen, snap_title_screen, title_screen);
 
 finally:
 
     /**
      * Clean up.
      */
+    if (render_thread) {
+        stop_snapshots(snapshots);
+        al_join_thread(render_thread, NULL);
+        al_destroy_thread(render_thread);
+    }
+    
+    /* The render thread might have been drawing its blocks */
+    destroy_title_screen(title_screen);
+    
+    if (snapshots) {
+        destroy_snapshots(snapshots);
+        
+        for (i = 0; i < NUM_SNAPSHOTS; i++) {
+            slot = slots[i];
+            free_memory("SNAPSHOT CELLS", slot->cells);
+            free_memory("SNAPSHOT", slot);
+        }
+    }
+    
+    /* Take the display back from the render thread */
+    if (display) {
+        al_set_target_backbuffer(display);
+    }
+    
+    stop_workers();
+    stop_sound();
+    destroy_clips();
+    destroy_block_types();
     stop_resources();
+    close_archive();
+    stop_watch();
     
     check_memory();
     
     al_destroy_display(display);
     al_destroy_event_queue(events);
     al_destroy_timer(timer);
+    al_destroy_timer(menu_timer);
 
     return status;
     
@@ -0,0 +1,424 @@
+#include <allegro5/allegro.h>
+#include <stdio.h>
+#include <string.h>
+#include "blocks.h"
+#include "resource.h"
+
+
+/* The first type is NO_BLOCK_TYPE, which is never used */
+static BLOCK_TYPE block_types[MAX_BLOCK_TYPES];
+static int num_block_types = NO_BLOCK_TYPE + 1;
+
+static const char *blast_shape_names[NUM_BLAST_SHAPES] = {
+    "square",
+    "diamond",
+    "circle"
+};
+
+/* Levels are built by worker threads, which can add types */
+static ALLEGRO_MUTEX *block_types_mutex = NULL;
+
+
+/**
+ * Internal function.
+ */
+static void lock_block_types()
+{
+    if (block_types_mutex == NULL) {
+        block_types_mutex = al_create_mutex();
+    }
+
+    al_lock_mutex(block_types_mutex);
+}
+
+
+/**
+ * Internal function.
+ */
+static void unlock_block_types()
+{
+    al_unlock_mutex(block_types_mutex);
+}
+
+
+/**
+ * Internal function.
+ * Look for a type without locking.
+ */
+static int search_block_types(const char *name)
+{
+    int i;
+
+    for (i = NO_BLOCK_TYPE + 1; i < num_block_types; i++) {
+        if (block_types[i].users == 0) {
+            continue;
+        }
+
+        if (strcmp(block_types[i].name, name) == 0 ||
+            strcmp(block_types[i].filename, name) == 0) {
+            return i;
+        }
+    }
+
+    return NO_BLOCK_TYPE;
+}
+
+
+/**
+ * Internal function.
+ * Free a type that nothing uses, so its room can be used again.
+ * Lock the types first.
+ */
+static void free_block_type(BLOCK_TYPE *type)
+{
+    int i;
+
+    release_resource_image(type->image);
+
+    for (i = 0; i < type->num_damage; i++) {
+        release_resource_image(type->damage[i].image);
+    }
+
+    type->image = NULL;
+    type->num_damage = 0;
+    type->users = 0;
+}
+
+
+/**
+ * Internal function.
+ * Start a new type with an image and nothing special about it,
+ * with one user. Returns NO_BLOCK_TYPE if there's no room or the
+ * image can't be loaded. Lock the types first.
+ */
+static int new_block_type(const char *name, const char *filename, int hits)
+{
+    BLOCK_TYPE *type;
+    int number;
+
+    /* Use the room of a type that was freed first */
+    for (number = NO_BLOCK_TYPE + 1; number < num_block_types; number++) {
+        if (block_types[number].users == 0) {
+            break;
+        }
+    }
+
+    if (number >= MAX_BLOCK_TYPES) {
+        fprintf(stderr, "BLOCKS: Failed to add block type \"%s\".\n", name);
+        fprintf(stderr, "Please increase MAX_BLOCK_TYPES.\n");
+        return NO_BLOCK_TYPE;
+    }
+
+    type = &block_types[number];
+
+    type->image = acquire_resource_image(filename);
+
+    if (type->image == NULL) {
+        fprintf(stderr, "BLOCKS: Failed to load image of block type \"%s\".\n", name);
+        return NO_BLOCK_TYPE;
+    }
+
+    strncpy(type->name, name, BLOCK_NAME_SIZE - 1);
+    type->name[BLOCK_NAME_SIZE - 1] = '\0';
+    strncpy(type->filename, filename, BLOCK_FILENAME_SIZE - 1);
+    type->filename[BLOCK_FILENAME_SIZE - 1] = '\0';
+    type->hits = hits;
+    type->num_damage = 0;
+    type->powerup_percent = LEVEL_POWERUPS;
+    type->num_drops = 0;
+    type->total_weight = 0;
+    type->blast = 0;
+    type->blast_shape = BLAST_SQUARE;
+    type->users = 1;
+
+    if (number == num_block_types) {
+        num_block_types++;
+    }
+
+    return number;
+}
+
+
+int load_block_types(const char *filename, const char **powerups, int num_powerups)
+{
+    FILE *file;
+    BLOCK_TYPE *type = NULL;
+    BLOCK_DAMAGE *damage;
+    BLOCK_DROP *drop;
+    char word[BLOCK_FILENAME_SIZE];
+    char name[BLOCK_NAME_SIZE];
+    char image[BLOCK_FILENAME_SIZE];
+    int hits;
+    int number;
+    int shape;
+    int powerup;
+    int count = 0;
+
+    file = open_resource_stream(filename);
+
+    if (file == NULL) {
+        fprintf(stderr, "BLOCKS: Failed to open block types \"%s\".\n", filename);
+        return -1;
+    }
+
+    lock_block_types();
+
+    while (fscanf(file, "%255s", word) == 1) {
+
+        /* Skip comments */
+        if (word[0] == '#') {
+            fscanf(file, "%*[^\n]");
+            continue;
+        }
+
+        if (strcmp(word, "TYPE") == 0) {
+            if (fscanf(file, "%31s %255s %d", name, image, &hits) != 3) {
+                fprintf(stderr, "BLOCKS: Failed to load block type in \"%s\".\n", filename);
+                break;
+            }
+
+            type = NULL;
+
+            if (search_block_types(name) != NO_BLOCK_TYPE) {
+                fprintf(stderr, "BLOCKS: There's already a block type \"%s\".\n", name);
+                continue;
+            }
+
+            number = new_block_type(name, image, hits);
+
+            if (number != NO_BLOCK_TYPE) {
+                type = &block_types[number];
+                count++;
+            }
+
+        } else if (strcmp(word, "DAMAGE") == 0) {
+            if (fscanf(file, "%d %255s", &hits, image) != 2) {
+                fprintf(stderr, "BLOCKS: Failed to load damage in \"%s\".\n", filename);
+                break;
+            }
+
+            /* Lines of a type that failed to load are skipped */
+            if (type == NULL) {
+                continue;
+            }
+
+            if (type->num_damage >= MAX_BLOCK_DAMAGE) {
+                fprintf(stderr, "BLOCKS: Too much damage for block type \"%s\".\n", type->name);
+                fprintf(stderr, "Please increase MAX_BLOCK_DAMAGE.\n");
+                continue;
+            }
+
+            damage = &type->damage[type->num_damage];
+            damage->hits = hits;
+            damage->image = acquire_resource_image(image);
+
+            if (damage->image != NULL) {
+                type->num_damage++;
+            }
+
+        } else if (strcmp(word, "POWERUPS") == 0) {
+            if (fscanf(file, "%d", &number) != 1 || number < 0 || number > 100) {
+                fprintf(stderr, "BLOCKS: The powerup percent has to be from 0 to 100 in \"%s\".\n",
+                        filename);
+                break;
+            }
+
+            if (type != NULL) {
+                type->powerup_percent = number;
+            }
+
+        } else if (strcmp(word, "DROP") == 0) {
+            if (fscanf(file, "%31s %d", name, &number) != 2 || number <= 0) {
+                fprintf(stderr, "BLOCKS: Failed to load drop in \"%s\".\n", filename);
+                break;
+            }
+
+            for (powerup = 0; powerup < num_powerups; powerup++) {
+                if (strcmp(powerups[powerup], name) == 0) {
+                    break;
+                }
+            }
+
+            if (powerup == num_powerups) {
+                fprintf(stderr, "BLOCKS: Unknown powerup \"%s\" in \"%s\".\n", name, filename);
+                break;
+            }
+
+            if (type == NULL) {
+                continue;
+            }
+
+            if (type->num_drops >= MAX_BLOCK_DROPS) {
+                fprintf(stderr, "BLOCKS: Too many drops for block type \"%s\".\n", type->name);
+                fprintf(stderr, "Please increase MAX_BLOCK_DROPS.\n");
+                continue;
+            }
+
+            drop = &type->drops[type->num_drops++];
+            strcpy(drop->powerup, name);
+            drop->weight = number;
+            type->total_weight += number;
+
+        } else if (strcmp(word, "BLAST") == 0) {
+            if (fscanf(file, "%d %31s", &number, name) != 2 || number < 0) {
+                fprintf(stderr, "BLOCKS: Failed to load blast in \"%s\".\n", filename);
+                break;
+            }
+
+            for (shape = 0; shape < NUM_BLAST_SHAPES; shape++) {
+                if (strcmp(blast_shape_names[shape], name) == 0) {
+                    break;
+                }
+            }
+
+            if (shape == NUM_BLAST_SHAPES) {
+                fprintf(stderr, "BLOCKS: Unknown blast shape \"%s\" in \"%s\".\n", name, filename);
+                break;
+            }
+
+            if (type != NULL) {
+                type->blast = number;
+                type->blast_shape = shape;
+            }
+
+        } else {
+            fprintf(stderr, "BLOCKS: Unknown word \"%s\" in \"%s\".\n", word, filename);
+            break;
+        }
+    }
+
+    unlock_block_types();
+
+    fclose(file);
+
+    return count;
+}
+
+
+void destroy_block_types()
+{
+    int i;
+
+    for (i = NO_BLOCK_TYPE + 1; i < num_block_types; i++) {
+        if (block_types[i].users > 0) {
+            free_block_type(&block_types[i]);
+        }
+    }
+
+    num_block_types = NO_BLOCK_TYPE + 1;
+
+    if (block_types_mutex != NULL) {
+        al_destroy_mutex(block_types_mutex);
+        block_types_mutex = NULL;
+    }
+}
+
+
+int find_block_type(const char *name)
+{
+    int type;
+
+    lock_block_types();
+    type = search_block_types(name);
+    unlock_block_types();
+
+    return type;
+}
+
+
+int add_block_type(const char *filename)
+{
+    int type;
+
+    lock_block_types();
+
+    type = search_block_types(filename);
+
+    if (type != NO_BLOCK_TYPE) {
+        block_types[type].users++;
+    } else {
+        type = new_block_type(filename, filename, 1);
+    }
+
+    unlock_block_types();
+
+    return type;
+}
+
+
+void release_block_type(int type)
+{
+    if (type == NO_BLOCK_TYPE) {
+        return;
+    }
+
+    lock_block_types();
+
+    block_types[type].users--;
+
+    if (block_types[type].users == 0) {
+        free_block_type(&block_types[type]);
+    }
+
+    unlock_block_types();
+}
+
+
+BLOCK_TYPE *get_block_type(int type)
+{
+    return &block_types[type];
+}
+
+
+ALLEGRO_BITMAP *block_type_image(BLOCK_TYPE *type, int hits)
+{
+    ALLEGRO_BITMAP *image = type->image;
+    int lowest = -1;
+    int i;
+
+    /* Use the closest damage image that the block is down to */
+    for (i = 0; i < type->num_damage; i++) {
+        if (hits <= type->damage[i].hits && (lowest < 0 || type->damage[i].hits < lowest)) {
+            lowest = type->damage[i].hits;
+            image = type->damage[i].image;
+        }
+    }
+
+    return image;
+}
+
+
+const char *pick_block_drop(BLOCK_TYPE *type, int roll)
+{
+    int i;
+
+    for (i = 0; i < type->num_drops; i++) {
+        if (roll < type->drops[i].weight) {
+            return type->drops[i].powerup;
+        }
+        roll -= type->drops[i].weight;
+    }
+
+    return NULL;
+}
+
+
+int is_in_blast(int dx, int dy, int radius, BLAST_SHAPE shape)
+{
+    if (dx < 0) {
+        dx = -dx;
+    }
+
+    if (dy < 0) {
+        dy = -dy;
+    }
+
+    switch (shape) {
+    case BLAST_DIAMOND:
+        return dx + dy <= radius;
+    case BLAST_CIRCLE:
+        return dx * dx + dy * dy <= radius * radius;
+    default:
+        return dx <= radius && dy <= radius;
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+
+#include <allegro5/allegro.h>
+
+
+/**
+ * The kinds of blocks, loaded from a block types file. Maps
+ * keep the number of each block's type instead of its image,
+ * so everything about a block is looked up in one table.
+ */
+
+
+#define MAX_BLOCK_TYPES 64
+#define MAX_BLOCK_DAMAGE 4          /* Damage images for each type */
+#define MAX_BLOCK_DROPS 8           /* Powerups in each drop table */
+#define BLOCK_NAME_SIZE 32
+#define BLOCK_FILENAME_SIZE 256
+
+/* The type of a cell without a block */
+#define NO_BLOCK_TYPE 0
+
+/* Use the level's powerup percent */
+#define LEVEL_POWERUPS -1
+
+
+/**
+ * The shape of the area that a blast hits, out to its radius.
+ */
+typedef enum BLAST_SHAPE {
+    BLAST_SQUARE = 0,
+    BLAST_DIAMOND,              /* Only the four blocks touching it at radius 1 */
+    BLAST_CIRCLE,
+    NUM_BLAST_SHAPES
+} BLAST_SHAPE;
+
+
+/**
+ * An image to show once a block is down to a number of hits.
+ */
+typedef struct BLOCK_DAMAGE {
+    int hits;
+    ALLEGRO_BITMAP *image;
+} BLOCK_DAMAGE;
+
+
+/**
+ * A powerup that a block can drop, and how likely it is
+ * compared to the others in the table.
+ */
+typedef struct BLOCK_DROP {
+    char powerup[BLOCK_NAME_SIZE];
+    int weight;
+} BLOCK_DROP;
+
+
+typedef struct BLOCK_TYPE {
+    char name[BLOCK_NAME_SIZE];
+    char filename[BLOCK_FILENAME_SIZE];     /* Of the image */
+    ALLEGRO_BITMAP *image;
+    int hits;                   /* For blocks that don't say how many */
+
+    BLOCK_DAMAGE damage[MAX_BLOCK_DAMAGE];
+    int num_damage;
+
+    int powerup_percent;        /* Or LEVEL_POWERUPS */
+    BLOCK_DROP drops[MAX_BLOCK_DROPS];      /* Any powerup if it's empty */
+    int num_drops;
+    int total_weight;
+
+    int blast;                  /* Blocks hit around it when it's destroyed */
+    BLAST_SHAPE blast_shape;
+
+    int users;                  /* The type is freed when nothing uses it */
+} BLOCK_TYPE;
+
+
+/**
+ * Load the block types in a block types file, which looks
+ * like this:
+ *
+ *   # name   image            hits
+ *   TYPE rock block-rock.bmp   3
+ *   DAMAGE 2 block-rock-2.bmp
+ *   DAMAGE 1 block-rock-1.bmp
+ *   POWERUPS 20
+ *   DROP drill 3
+ *   DROP blast 1
+ *   BLAST 1 square
+ *
+ * DAMAGE shows an image once the block is down to that many
+ * hits. POWERUPS is the percent of these blocks that drop a
+ * powerup when they're destroyed, instead of the level's. DROP
+ * adds a powerup to the drop table with a weight, and without
+ * any every powerup is just as likely. BLAST hits the blocks
+ * within that many cells when the block is destroyed, in a
+ * square, diamond or circle.
+ * Lines starting with "#" are comments. Images are found with
+ * the resource library (see resource.h). A DROP has to name one
+ * of the powerups in the list. The types in the file are kept
+ * until destroy_block_types.
+ * Returns the number of types, or -1 on failure.
+ */
+int load_block_types(const char *filename, const char **powerups, int num_powerups);
+
+/**
+ * Free every block type and let go of their images.
+ */
+void destroy_block_types();
+
+/**
+ * Find a block type by its name, or by its image filename.
+ * Returns NO_BLOCK_TYPE if there's no such type.
+ */
+int find_block_type(const char *name);
+
+/**
+ * Get the type that uses an image, adding a plain type for
+ * it if there isn't one, so levels can use any image as a
+ * block. Each call has to be paired with release_block_type.
+ * Can be called by any thread.
+ * Returns NO_BLOCK_TYPE if the image can't be loaded.
+ */
+int add_block_type(const char *filename);
+
+/**
+ * Stop using a type from add_block_type. Plain types are
+ * freed once nothing uses them, so their room can be used
+ * by the types of the next level. Can be called by any thread.
+ */
+void release_block_type(int type);
+
+/**
+ * Get a block type by its number. Types don't move or change
+ * while they're used, so this doesn't lock anything.
+ */
+BLOCK_TYPE *get_block_type(int type);
+
+/**
+ * Get the image of a block with some hits left.
+ */
+ALLEGRO_BITMAP *block_type_image(BLOCK_TYPE *type, int hits);
+
+/**
+ * Pick a powerup out of the drop table, with a roll from 0 to
+ * total_weight - 1. Returns NULL if any powerup will do.
+ */
+const char *pick_block_drop(BLOCK_TYPE *type, int roll);
+
+/**
+ * Check if a cell is inside a blast, by how far it is from the
+ * middle of the blast.
+ */
+int is_in_blast(int dx, int dy, int radius, BLAST_SHAPE shape);
+
+
+#endif
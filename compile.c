@@ -0,0 +1,105 @@
+/**
+ * Compile levels so the game can load them without
+ * reading any text.
+ *
+ *   compile-tool data/level01.dat data/level02.dat ...
+ *
+ * Or run "make compile" to compile the levels in data/ whose
+ * text changed. A compiled level is written next to its text
+ * file as a ".lvl" file, which load_level uses instead of the
+ * text as long as it isn't older.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+
+#include "level.h"
+#include "memory.h"
+
+
+#define MAX_FILENAME_SIZE 256
+
+
+int compile(const char *filename)
+{
+    LEVEL *level;
+    FILE *file;
+    char *text;
+    char compiled[MAX_FILENAME_SIZE];
+    long size;
+    int ok;
+
+  /**
+   * The text is read directly, since load_level would
+   * pick up the old compiled level.
+   */
+    file = fopen(filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open level \"%s\".\n", filename);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    text = alloc_memory("COMPILE TEXT", size + 1);
+    ok = fread(text, 1, size, file) == (size_t)size;
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Failed to read level \"%s\".\n", filename);
+        free_memory("COMPILE TEXT", text);
+        return 0;
+    }
+
+    level = parse_level(text, size, filename);
+    free_memory("COMPILE TEXT", text);
+
+    if (level == NULL) {
+        return 0;
+    }
+
+    compiled_level_filename(compiled, filename, MAX_FILENAME_SIZE);
+
+    if (!save_compiled_level(level, compiled)) {
+        fprintf(stderr, "Failed to save compiled level \"%s\".\n", compiled);
+        destroy_level(level);
+        return 0;
+    }
+
+    printf("%s -> %s\n", filename, compiled);
+
+    destroy_level(level);
+
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s LEVEL...\n", argv[0]);
+        return 1;
+    }
+
+    /* The memory library uses an allegro mutex */
+    if (!al_init()) {
+        fprintf(stderr, "Failed to initialize allegro.\n");
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (!compile(argv[i])) {
+            failed++;
+        }
+    }
+
+    check_memory();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * Generate levels for benchmarks and soak tests, so the game can
+ * be pushed harder than the hand made levels do.
+ *
+ *   generate-tool [OPTION...] LEVEL WIDTH HEIGHT
+ *
+ *   --density PERCENT   Cells with a block (default 50)
+ *   --hits N            Most hits a block can take (default 3)
+ *   --paddles N         Paddles around the edges (default 4)
+ *   --balls N           (default 1)
+ *   --holes N           (default 4)
+ *   --powerups PERCENT  Destroyed blocks that drop a powerup (default 10)
+ *   --seed N            The same seed makes the same level (default 1)
+ *
+ * Or run "make stress" to make a set of levels in stress/ that go
+ * from small to as big as levels can be.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "level.h"
+#include "random.h"
+
+
+#define BLOCK_SIZE 20 /* Pixels, the same as the game */
+#define NUM_BLOCK_IDS 3
+
+
+typedef struct SETTINGS {
+    int width;
+    int height;
+    int density;
+    int hits;
+    int paddles;
+    int balls;
+    int holes;
+    int powerups;
+    unsigned long seed;
+} SETTINGS;
+
+
+/**
+ * Find a random spot on the field, in the middle of a cell
+ * that isn't on the edge.
+ */
+void random_spot(RANDOM *random, SETTINGS *settings, int *x, int *y)
+{
+    *x = next_random_number(random, 1, settings->width - 2) * BLOCK_SIZE + BLOCK_SIZE / 2;
+    *y = next_random_number(random, 1, settings->height - 2) * BLOCK_SIZE + BLOCK_SIZE / 2;
+}
+
+
+int generate(const char *filename, SETTINGS *settings)
+{
+    static const char ids[NUM_BLOCK_IDS] = {'D', 'F', 'R'};
+    RANDOM random;
+    FILE *file;
+    int w = settings->width * BLOCK_SIZE;
+    int h = settings->height * BLOCK_SIZE;
+    int x = 0;
+    int y = 0;
+    int i = 0;
+
+    file = fopen(filename, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open \"%s\".\n", filename);
+        return 0;
+    }
+
+    seed_random_state(&random, settings->seed);
+
+    fprintf(file, "# Made by generate-tool with seed %lu\n\n", settings->seed);
+
+  /**
+   * The paddles go around the edges, top, bottom, left
+   * then right, spread out a little more each time around.
+   */
+    for (i = 0; i < settings->paddles; i++) {
+        x = w / 2 + ((i / 4) % 2 ? -1 : 1) * (i / 4) * BLOCK_SIZE * 2;
+        y = h / 2 + ((i / 4) % 2 ? -1 : 1) * (i / 4) * BLOCK_SIZE * 2;
+
+        switch (i % 4) {
+        case 0:
+            fprintf(file, "PADDLE %d %d H\n", x, BLOCK_SIZE * 3);
+            break;
+        case 1:
+            fprintf(file, "PADDLE %d %d H\n", x, h - BLOCK_SIZE * 3);
+            break;
+        case 2:
+            fprintf(file, "PADDLE %d %d V\n", BLOCK_SIZE * 3, y);
+            break;
+        default:
+            fprintf(file, "PADDLE %d %d V\n", w - BLOCK_SIZE * 3, y);
+            break;
+        }
+    }
+
+    for (i = 0; i < settings->balls; i++) {
+        random_spot(&random, settings, &x, &y);
+        fprintf(file, "BALL %d %d %d\n", x, y, next_random_number(&random, 0, 359));
+    }
+
+    for (i = 0; i < settings->holes; i++) {
+        random_spot(&random, settings, &x, &y);
+        fprintf(file, "HOLE %d %d\n", x, y);
+    }
+
+    fprintf(file, "\nBLOCK D block-daisy.bmp\n");
+    fprintf(file, "BLOCK F block-fern.bmp\n");
+    fprintf(file, "BLOCK R block-rose.bmp\n");
+    fprintf(file, "\nPOWERUPS %d\n", settings->powerups);
+    fprintf(file, "\nMAP %d %d\n", settings->width, settings->height);
+
+    for (y = 0; y < settings->height; y++) {
+        for (x = 0; x < settings->width; x++) {
+            if (next_random_number(&random, 1, 100) <= settings->density) {
+                fprintf(file, "%c%d", ids[next_random_number(&random, 0, NUM_BLOCK_IDS - 1)],
+                        next_random_number(&random, 1, settings->hits));
+            } else {
+                fputs("00", file);
+            }
+            fputc(x == settings->width - 1 ? '\n' : ' ', file);
+        }
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write \"%s\".\n", filename);
+        return 0;
+    }
+
+    printf("%s: %dx%d, %d%% blocks\n", filename, settings->width, settings->height, settings->density);
+
+    return 1;
+}
+
+
+/**
+ * Check that a setting is in range, and print what's wrong if it isn't.
+ */
+int check_setting(const char *name, int value, int low, int high)
+{
+    if (value < low || value > high) {
+        fprintf(stderr, "The %s has to be from %d to %d.\n", name, low, high);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [OPTION...] LEVEL WIDTH HEIGHT\n", program);
+    fprintf(stderr, "Options: --density PERCENT --hits N --paddles N --balls N --holes N\n");
+    fprintf(stderr, "         --powerups PERCENT --seed N\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    SETTINGS settings;
+    int i = 1;
+
+    settings.density = 50;
+    settings.hits = 3;
+    settings.paddles = 4;
+    settings.balls = 1;
+    settings.holes = 4;
+    settings.powerups = DEFAULT_LEVEL_POWERUPS;
+    settings.seed = 1;
+
+    for (i = 1; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+        if (strcmp(argv[i], "--density") == 0) {
+            settings.density = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--hits") == 0) {
+            settings.hits = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--paddles") == 0) {
+            settings.paddles = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--balls") == 0) {
+            settings.balls = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--holes") == 0) {
+            settings.holes = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--powerups") == 0) {
+            settings.powerups = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            settings.seed = strtoul(argv[i + 1], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - i != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    settings.width = atoi(argv[i + 1]);
+    settings.height = atoi(argv[i + 2]);
+
+    /* Paddles need room to move, so the map has to be a few blocks wide */
+    if (!check_setting("width", settings.width, 8, MAX_LEVEL_SIZE) ||
+        !check_setting("height", settings.height, 8, MAX_LEVEL_SIZE) ||
+        !check_setting("density", settings.density, 0, 100) ||
+        !check_setting("number of hits", settings.hits, 1, MAX_COMPILED_HITS) ||
+        !check_setting("number of paddles", settings.paddles, 0, MAX_LEVEL_PADDLES) ||
+        !check_setting("number of balls", settings.balls, 0, MAX_LEVEL_BALLS) ||
+        !check_setting("number of holes", settings.holes, 0, MAX_LEVEL_HOLES) ||
+        !check_setting("powerup percent", settings.powerups, 0, 100)) {
+        return 1;
+    }
+
+    return generate(argv[i], &settings) ? 0 : 1;
+}
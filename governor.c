@@ -0,0 +1,192 @@
+#include <allegro5/allegro.h>
+
+#include "governor.h"
+
+
+/**
+ * Fraction of the time budget that can be used before
+ * the quality is lowered.
+ */
+#define DEGRADE_LOAD 0.9
+
+/**
+ * Fraction of the time budget that has to be free before
+ * the quality is raised again.
+ */
+#define RESTORE_LOAD 0.5
+
+/* How long the game has to be too slow before lowering the quality */
+#define DEGRADE_DELAY 0.5 /* In seconds */
+
+/* How long the game has to be fast enough before raising the quality */
+#define RESTORE_DELAY 3 /* In seconds */
+
+/* Never wait longer than this to try raising the quality */
+#define MAX_RESTORE_DELAY 60 /* In seconds */
+
+/* How quickly the averages follow new measurements, 0 to 1 */
+#define SMOOTHING 0.1
+
+
+static float governor_fps = 60; /* A default value of 60 frames per second */
+
+static QUALITY quality = QUALITY_FULL;
+
+/* Running averages, in seconds */
+static double tick_time = 0;
+static double frame_time = 0;
+
+/* Number of updates in a row the game was too slow or fast enough */
+static int slow_ticks = 0;
+static int fast_ticks = 0;
+
+/**
+ * Updates to wait before raising the quality. This grows
+ * when raising the quality makes the game too slow again,
+ * so the governor doesn't keep flipping between two levels.
+ */
+static int restore_ticks = 0;
+
+/* Updates since the quality was last raised */
+static int ticks_since_restore = 0;
+
+static int skip_toggle = 0;
+
+/**
+ * Updating and drawing happen on different threads, so
+ * the measurements and the quality are guarded by a lock.
+ */
+static ALLEGRO_MUTEX *mutex = NULL;
+
+
+void init_governor(float fps)
+{
+    governor_fps = fps;
+
+    if (mutex == NULL) {
+        mutex = al_create_mutex();
+    }
+
+    quality = QUALITY_FULL;
+    tick_time = 0;
+    frame_time = 0;
+    slow_ticks = 0;
+    fast_ticks = 0;
+    restore_ticks = RESTORE_DELAY * governor_fps;
+    ticks_since_restore = restore_ticks;
+    skip_toggle = 0;
+}
+
+
+void governor_tick_time(double seconds)
+{
+    al_lock_mutex(mutex);
+    tick_time += (seconds - tick_time) * SMOOTHING;
+    al_unlock_mutex(mutex);
+}
+
+
+void governor_frame_time(double seconds)
+{
+    al_lock_mutex(mutex);
+    frame_time += (seconds - frame_time) * SMOOTHING;
+    al_unlock_mutex(mutex);
+}
+
+
+void update_governor()
+{
+    double budget = 1.0 / governor_fps;
+    double load = 0;
+    double frames_per_tick = 1;
+
+    al_lock_mutex(mutex);
+
+    if (quality >= QUALITY_SKIP_FRAMES) {
+        frames_per_tick = 0.5;
+    }
+
+  /**
+   * Updating and drawing run side by side, so whichever
+   * one takes longer decides how fast the game can go.
+   */
+    load = frame_time * frames_per_tick;
+    if (tick_time > load) {
+        load = tick_time;
+    }
+    load /= budget;
+
+    if (ticks_since_restore < restore_ticks * 2) {
+        ticks_since_restore++;
+    }
+
+    if (load > DEGRADE_LOAD) {
+        slow_ticks++;
+        fast_ticks = 0;
+    } else if (load < RESTORE_LOAD) {
+        fast_ticks++;
+        slow_ticks = 0;
+    } else {
+        slow_ticks = 0;
+        fast_ticks = 0;
+    }
+
+    /* Too slow, lower the quality */
+    if (slow_ticks >= DEGRADE_DELAY * governor_fps) {
+        slow_ticks = 0;
+
+        if (quality < NUM_QUALITY_LEVELS - 1) {
+            quality++;
+        }
+
+        /**
+         * The last time the quality was raised it didn't
+         * last, so wait longer before trying again.
+         */
+        if (ticks_since_restore < restore_ticks) {
+            restore_ticks *= 2;
+            if (restore_ticks > MAX_RESTORE_DELAY * governor_fps) {
+                restore_ticks = MAX_RESTORE_DELAY * governor_fps;
+            }
+        }
+    }
+
+    /* Plenty of time to spare, raise the quality */
+    if (fast_ticks >= restore_ticks) {
+        fast_ticks = 0;
+
+        if (quality > QUALITY_FULL) {
+            quality--;
+            ticks_since_restore = 0;
+        } else {
+            /* Everything is running great, forget about the past */
+            restore_ticks = RESTORE_DELAY * governor_fps;
+        }
+    }
+
+    al_unlock_mutex(mutex);
+}
+
+
+QUALITY get_quality()
+{
+    QUALITY current;
+
+    al_lock_mutex(mutex);
+    current = quality;
+    al_unlock_mutex(mutex);
+
+    return current;
+}
+
+
+int governor_skip_frame()
+{
+    if (quality < QUALITY_SKIP_FRAMES) {
+        return 0;
+    }
+
+    skip_toggle = skip_toggle ? 0 : 1;
+
+    return skip_toggle;
+}
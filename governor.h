@@ -0,0 +1,56 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+
+/**
+ * The quality governor watches how long updating and drawing
+ * take and lowers the drawing quality one step at a time when
+ * the game can't keep up. When there is time to spare again,
+ * the quality is slowly brought back up.
+ *
+ * Every level includes the savings of the levels before it.
+ */
+typedef enum QUALITY {
+    QUALITY_FULL = 0,
+    QUALITY_NO_SHADOWS,     /* Don't draw shadows */
+    QUALITY_NO_ROTATION,    /* Draw the bees without rotating them */
+    QUALITY_SLOW_HOLES,     /* Animate the holes at a lower rate */
+    QUALITY_SKIP_FRAMES,    /* Only draw every other frame */
+    NUM_QUALITY_LEVELS
+} QUALITY;
+
+
+/**
+ * Initialize the governor.
+ * Send the frames per second that the game is running at.
+ */
+void init_governor(float fps);
+
+/**
+ * Report how long, in seconds, one game update took.
+ */
+void governor_tick_time(double seconds);
+
+/**
+ * Report how long, in seconds, drawing one frame took.
+ */
+void governor_frame_time(double seconds);
+
+/**
+ * Let the governor decide if the quality should change.
+ * Call this once per game update.
+ */
+void update_governor();
+
+/**
+ * The current quality level.
+ */
+QUALITY get_quality();
+
+/**
+ * Returns true if the current frame shouldn't be drawn.
+ */
+int governor_skip_frame();
+
+
+#endif
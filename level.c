@@ -0,0 +1,823 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "level.h"
+#include "memory.h"
+
+
+/**
+ * Reads a level one token at a time, keeping track
+ * of the line and column for error messages.
+ */
+typedef struct LEXER {
+    const char *pos;
+    const char *end;
+    const char *name;
+    int line;
+    const char *line_start;
+} LEXER;
+
+
+/**
+ * Internal function.
+ */
+static void level_error(LEXER *lexer, const char *message)
+{
+    fprintf(stderr, "%s:%d:%d: %s\n", lexer->name, lexer->line,
+            (int)(lexer->pos - lexer->line_start) + 1, message);
+}
+
+
+/**
+ * Internal function.
+ * Skip whitespace and comments.
+ */
+static void skip_space(LEXER *lexer)
+{
+    while (lexer->pos < lexer->end) {
+        if (*lexer->pos == '\n') {
+            lexer->pos++;
+            lexer->line++;
+            lexer->line_start = lexer->pos;
+        } else if (*lexer->pos == ' ' || *lexer->pos == '\t' || *lexer->pos == '\r') {
+            lexer->pos++;
+        } else if (*lexer->pos == '#') {
+            while (lexer->pos < lexer->end && *lexer->pos != '\n') {
+                lexer->pos++;
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Internal function.
+ */
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
+/**
+ * Internal function.
+ * Read a word, such as "PADDLE". Returns false at the end.
+ */
+static int read_word(LEXER *lexer, char *word, int size)
+{
+    int length = 0;
+
+    skip_space(lexer);
+
+    while (lexer->pos < lexer->end && !is_space(*lexer->pos)) {
+        if (length < size - 1) {
+            word[length++] = *lexer->pos;
+        }
+        lexer->pos++;
+    }
+
+    word[length] = '\0';
+
+    return length > 0;
+}
+
+
+/**
+ * Internal function.
+ * Read a number right where the lexer is, without skipping
+ * anything first.
+ */
+static int read_digits(LEXER *lexer, int *value, const char *what)
+{
+    char message[LEVEL_STRING_SIZE];
+    int negative = 0;
+    int digits = 0;
+    int n = 0;
+
+    if (lexer->pos < lexer->end && *lexer->pos == '-') {
+        negative = 1;
+        lexer->pos++;
+    }
+
+    while (lexer->pos < lexer->end && *lexer->pos >= '0' && *lexer->pos <= '9') {
+        if (n > (INT_MAX - (*lexer->pos - '0')) / 10) {
+            level_error(lexer, "Number is too big.");
+            return 0;
+        }
+        n = n * 10 + (*lexer->pos - '0');
+        lexer->pos++;
+        digits++;
+    }
+
+    if (digits == 0 || (lexer->pos < lexer->end && !is_space(*lexer->pos))) {
+        strcpy(message, "Expected the ");
+        strncat(message, what, LEVEL_STRING_SIZE - strlen(message) - 2);
+        strcat(message, ".");
+        level_error(lexer, message);
+        return 0;
+    }
+
+    *value = negative ? -n : n;
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ * Read a number, such as the x position of a paddle.
+ * The "what" is used in the error message.
+ */
+static int read_number(LEXER *lexer, int *value, const char *what)
+{
+    skip_space(lexer);
+
+    return read_digits(lexer, value, what);
+}
+
+
+/**
+ * Internal function.
+ * Read one character, such as a block id.
+ */
+static int read_char(LEXER *lexer, char *c, const char *what)
+{
+    char message[LEVEL_STRING_SIZE];
+
+    skip_space(lexer);
+
+    if (lexer->pos >= lexer->end) {
+        strcpy(message, "Expected the ");
+        strncat(message, what, LEVEL_STRING_SIZE - strlen(message) - 2);
+        strcat(message, ".");
+        level_error(lexer, message);
+        return 0;
+    }
+
+    *c = *lexer->pos++;
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ * Read the rest of the line, such as an image filename,
+ * which can have spaces in it.
+ */
+static int read_rest_of_line(LEXER *lexer, char *text, int size, const char *what)
+{
+    char message[LEVEL_STRING_SIZE];
+    int length = 0;
+
+    while (lexer->pos < lexer->end && (*lexer->pos == ' ' || *lexer->pos == '\t')) {
+        lexer->pos++;
+    }
+
+    while (lexer->pos < lexer->end && *lexer->pos != '\n') {
+        if (length < size - 1) {
+            text[length++] = *lexer->pos;
+        }
+        lexer->pos++;
+    }
+
+    /* Get rid of trailing whitespace */
+    while (length > 0 && is_space(text[length - 1])) {
+        length--;
+    }
+
+    text[length] = '\0';
+
+    if (length == 0) {
+        strcpy(message, "Expected the ");
+        strncat(message, what, LEVEL_STRING_SIZE - strlen(message) - 2);
+        strcat(message, ".");
+        level_error(lexer, message);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ * Read the cells of the map. The block ids are looked up
+ * in a table indexed by the id character.
+ */
+static int read_cells(LEXER *lexer, LEVEL *level, const signed char *id_table)
+{
+    LEVEL_CELL *cell;
+    unsigned char id;
+    int i;
+
+    for (i = 0; i < level->width * level->height; i++) {
+        cell = &level->cells[i];
+
+        skip_space(lexer);
+
+        if (lexer->pos >= lexer->end) {
+            level_error(lexer, "Expected more map cells.");
+            return 0;
+        }
+
+        id = (unsigned char)*lexer->pos++;
+
+        if (lexer->pos < lexer->end && *lexer->pos == '-') {
+            level_error(lexer, "Block hits can't be negative.");
+            return 0;
+        }
+
+        if (!read_digits(lexer, &cell->hits, "block hits")) {
+            return 0;
+        }
+
+        if (id == '0') {
+            /* No block, empty space */
+            cell->block = NO_LEVEL_BLOCK;
+            cell->hits = 0;
+            continue;
+        }
+
+        cell->block = id_table[id];
+
+        if (cell->block == NO_LEVEL_BLOCK) {
+            lexer->pos--;
+            level_error(lexer, "Unknown block id, add a BLOCK line for it.");
+            return 0;
+        }
+
+        level->block_ids[cell->block].count++;
+
+        if (cell->hits > 0) {
+            level->num_blocks++;
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ */
+static LEVEL *create_level()
+{
+    LEVEL *level = alloc_memory("LEVEL", sizeof(LEVEL));
+
+    level->num_paddles = 0;
+    level->num_balls = 0;
+    level->num_holes = 0;
+    level->num_block_ids = 0;
+    level->powerup_percent = DEFAULT_LEVEL_POWERUPS;
+    level->cells = NULL;
+    level->width = 0;
+    level->height = 0;
+    level->num_blocks = 0;
+
+    return level;
+}
+
+
+LEVEL *parse_level(const char *text, long size, const char *name)
+{
+    LEVEL *level;
+    LEXER lexer;
+    char word[LEVEL_STRING_SIZE];
+    signed char id_table[UCHAR_MAX + 1];
+    LEVEL_PADDLE *paddle;
+    LEVEL_BALL *ball;
+    LEVEL_HOLE *hole;
+    LEVEL_BLOCK_ID *block_id;
+    int ok = 1;
+
+    lexer.pos = text;
+    lexer.end = text + size;
+    lexer.name = name;
+    lexer.line = 1;
+    lexer.line_start = text;
+
+    memset(id_table, NO_LEVEL_BLOCK, sizeof(id_table));
+
+    level = create_level();
+
+    while (ok && read_word(&lexer, word, LEVEL_STRING_SIZE)) {
+
+        if (strcmp(word, "PADDLE") == 0) {
+            if (level->num_paddles >= MAX_LEVEL_PADDLES) {
+                level_error(&lexer, "Too many paddles, try increasing MAX_LEVEL_PADDLES.");
+                ok = 0;
+                break;
+            }
+
+            paddle = &level->paddles[level->num_paddles++];
+
+            ok = read_number(&lexer, &paddle->x, "paddle x position") &&
+                read_number(&lexer, &paddle->y, "paddle y position") &&
+                read_char(&lexer, &paddle->orientation, "paddle orientation");
+
+            if (ok && paddle->orientation != 'H' && paddle->orientation != 'V') {
+                lexer.pos--;
+                level_error(&lexer, "The paddle orientation has to be H or V.");
+                ok = 0;
+            }
+
+        } else if (strcmp(word, "BALL") == 0) {
+            if (level->num_balls >= MAX_LEVEL_BALLS) {
+                level_error(&lexer, "Too many balls, try increasing MAX_LEVEL_BALLS.");
+                ok = 0;
+                break;
+            }
+
+            ball = &level->balls[level->num_balls++];
+
+            ok = read_number(&lexer, &ball->x, "ball x position") &&
+                read_number(&lexer, &ball->y, "ball y position") &&
+                read_number(&lexer, &ball->angle, "ball angle");
+
+        } else if (strcmp(word, "HOLE") == 0) {
+            if (level->num_holes >= MAX_LEVEL_HOLES) {
+                level_error(&lexer, "Too many holes, try increasing MAX_LEVEL_HOLES.");
+                ok = 0;
+                break;
+            }
+
+            hole = &level->holes[level->num_holes++];
+
+            ok = read_number(&lexer, &hole->x, "hole x position") &&
+                read_number(&lexer, &hole->y, "hole y position");
+
+        } else if (strcmp(word, "BLOCK") == 0) {
+            if (level->num_block_ids >= MAX_LEVEL_BLOCK_IDS) {
+                level_error(&lexer, "Too many block ids, try increasing MAX_LEVEL_BLOCK_IDS.");
+                ok = 0;
+                break;
+            }
+
+            block_id = &level->block_ids[level->num_block_ids];
+            block_id->count = 0;
+
+            ok = read_char(&lexer, &block_id->id, "block id") &&
+                read_rest_of_line(&lexer, block_id->image, LEVEL_STRING_SIZE, "block image");
+
+            if (ok && block_id->id == '0') {
+                level_error(&lexer, "Block id 0 is for empty spaces.");
+                ok = 0;
+            }
+
+            if (ok) {
+                id_table[(unsigned char)block_id->id] = level->num_block_ids;
+                level->num_block_ids++;
+            }
+
+        } else if (strcmp(word, "POWERUPS") == 0) {
+            ok = read_number(&lexer, &level->powerup_percent, "powerup percent");
+
+            if (ok && (level->powerup_percent < 0 || level->powerup_percent > 100)) {
+                level_error(&lexer, "The powerup percent has to be from 0 to 100.");
+                ok = 0;
+            }
+
+        } else if (strcmp(word, "MAP") == 0) {
+            if (level->cells != NULL) {
+                level_error(&lexer, "The level already has a map.");
+                ok = 0;
+                break;
+            }
+
+            ok = read_number(&lexer, &level->width, "map width") &&
+                read_number(&lexer, &level->height, "map height");
+
+            if (ok && (level->width <= 0 || level->height <= 0 ||
+                       level->width > MAX_LEVEL_SIZE || level->height > MAX_LEVEL_SIZE)) {
+                level_error(&lexer, "The map size is too big or too small.");
+                ok = 0;
+            }
+
+            if (ok) {
+                level->cells = calloc_memory("LEVEL CELLS", level->width * level->height,
+                                             sizeof(LEVEL_CELL));
+                ok = read_cells(&lexer, level, id_table);
+            }
+
+        } else {
+            lexer.pos -= strlen(word);
+            level_error(&lexer, "Unknown word, expected PADDLE, BALL, HOLE, BLOCK, POWERUPS or MAP.");
+            ok = 0;
+        }
+    }
+
+    if (ok && level->cells == NULL) {
+        level_error(&lexer, "The level doesn't have a map.");
+        ok = 0;
+    }
+
+    if (!ok) {
+        destroy_level(level);
+        return NULL;
+    }
+
+    return level;
+}
+
+
+/**
+ * Internal function.
+ * Read a little endian number out of a compiled level.
+ */
+static long read32(const unsigned char *p)
+{
+    return (long)((unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+                  ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24));
+}
+
+
+/**
+ * Internal function.
+ */
+static int write32(FILE *file, long n)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = n & 0xFF;
+    bytes[1] = (n >> 8) & 0xFF;
+    bytes[2] = (n >> 16) & 0xFF;
+    bytes[3] = (n >> 24) & 0xFF;
+
+    return fwrite(bytes, 1, 4, file) == 4;
+}
+
+
+/**
+ * Internal function.
+ * Copy a string out of the string table of a compiled level.
+ */
+static int read_compiled_string(char *dest, const unsigned char *strings,
+                                long strings_size, long offset)
+{
+    long length = 0;
+
+    if (offset < 0 || offset >= strings_size) {
+        return 0;
+    }
+
+    while (offset + length < strings_size && strings[offset + length] != '\0') {
+        length++;
+    }
+
+    /* Every string has to end inside the table */
+    if (offset + length >= strings_size || length >= LEVEL_STRING_SIZE) {
+        return 0;
+    }
+
+    memcpy(dest, strings + offset, length + 1);
+
+    return 1;
+}
+
+
+LEVEL *read_compiled_level(const char *data, long size, const char *name)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *strings;
+    LEVEL *level;
+    LEVEL_CELL *cell;
+    long strings_size;
+    long cells;
+    long needed;
+    int block;
+    int i;
+
+    if (size < COMPILED_LEVEL_HEADER_SIZE ||
+        memcmp(p, COMPILED_LEVEL_MAGIC, COMPILED_LEVEL_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "LEVEL: \"%s\" isn't a compiled level.\n", name);
+        return NULL;
+    }
+
+    if (read32(p + 4) != COMPILED_LEVEL_VERSION) {
+        fprintf(stderr, "LEVEL: \"%s\" was compiled by a different version.\n", name);
+        return NULL;
+    }
+
+    level = create_level();
+
+    level->num_paddles = read32(p + 8);
+    level->num_balls = read32(p + 12);
+    level->num_holes = read32(p + 16);
+    level->num_block_ids = read32(p + 20);
+    level->width = read32(p + 24);
+    level->height = read32(p + 28);
+    strings_size = read32(p + 32);
+    level->powerup_percent = read32(p + 36);
+
+    if (level->num_paddles < 0 || level->num_paddles > MAX_LEVEL_PADDLES ||
+        level->num_balls < 0 || level->num_balls > MAX_LEVEL_BALLS ||
+        level->num_holes < 0 || level->num_holes > MAX_LEVEL_HOLES ||
+        level->num_block_ids < 0 || level->num_block_ids > MAX_LEVEL_BLOCK_IDS ||
+        level->width <= 0 || level->width > MAX_LEVEL_SIZE ||
+        level->height <= 0 || level->height > MAX_LEVEL_SIZE ||
+        level->powerup_percent < 0 || level->powerup_percent > 100 ||
+        strings_size < 0) {
+        fprintf(stderr, "LEVEL: \"%s\" is broken.\n", name);
+        destroy_level(level);
+        return NULL;
+    }
+
+    cells = (long)level->width * level->height;
+    needed = COMPILED_LEVEL_HEADER_SIZE + level->num_paddles * 12 + level->num_balls * 12 +
+        level->num_holes * 8 + level->num_block_ids * 8 + cells * 2 + strings_size;
+
+    if (size < needed) {
+        fprintf(stderr, "LEVEL: \"%s\" is cut off.\n", name);
+        destroy_level(level);
+        return NULL;
+    }
+
+    strings = p + needed - strings_size;
+    p += COMPILED_LEVEL_HEADER_SIZE;
+
+    for (i = 0; i < level->num_paddles; i++, p += 12) {
+        level->paddles[i].x = read32(p);
+        level->paddles[i].y = read32(p + 4);
+        level->paddles[i].orientation = (char)read32(p + 8);
+    }
+
+    for (i = 0; i < level->num_balls; i++, p += 12) {
+        level->balls[i].x = read32(p);
+        level->balls[i].y = read32(p + 4);
+        level->balls[i].angle = read32(p + 8);
+    }
+
+    for (i = 0; i < level->num_holes; i++, p += 8) {
+        level->holes[i].x = read32(p);
+        level->holes[i].y = read32(p + 4);
+    }
+
+    for (i = 0; i < level->num_block_ids; i++, p += 8) {
+        level->block_ids[i].id = (char)read32(p);
+        level->block_ids[i].count = 0;
+
+        if (!read_compiled_string(level->block_ids[i].image, strings, strings_size, read32(p + 4))) {
+            fprintf(stderr, "LEVEL: \"%s\" has a broken block image.\n", name);
+            destroy_level(level);
+            return NULL;
+        }
+    }
+
+  /**
+   * The map is copied straight out, and the
+   * blocks are counted on the way.
+   */
+    level->cells = calloc_memory("LEVEL CELLS", cells, sizeof(LEVEL_CELL));
+
+    for (i = 0; i < cells; i++) {
+        cell = &level->cells[i];
+        block = p[i];
+
+        if (block == COMPILED_NO_BLOCK) {
+            cell->block = NO_LEVEL_BLOCK;
+            cell->hits = 0;
+            continue;
+        }
+
+        if (block >= level->num_block_ids) {
+            fprintf(stderr, "LEVEL: \"%s\" has a broken map.\n", name);
+            destroy_level(level);
+            return NULL;
+        }
+
+        cell->block = block;
+        cell->hits = p[cells + i];
+
+        level->block_ids[block].count++;
+
+        if (cell->hits > 0) {
+            level->num_blocks++;
+        }
+    }
+
+    return level;
+}
+
+
+int save_compiled_level(LEVEL *level, const char *filename)
+{
+    FILE *file;
+    long offset = 0;
+    long cells = (long)level->width * level->height;
+    int ok = 1;
+    int i;
+
+    for (i = 0; i < cells; i++) {
+        if (level->cells[i].hits < 0 || level->cells[i].hits > MAX_COMPILED_HITS) {
+            fprintf(stderr, "LEVEL: Blocks can't have more than %d hits.\n", MAX_COMPILED_HITS);
+            return 0;
+        }
+    }
+
+    file = fopen(filename, "wb");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    /* The string table holds every block image */
+    for (i = 0; i < level->num_block_ids; i++) {
+        offset += strlen(level->block_ids[i].image) + 1;
+    }
+
+    ok = fwrite(COMPILED_LEVEL_MAGIC, 1, COMPILED_LEVEL_MAGIC_SIZE, file) == COMPILED_LEVEL_MAGIC_SIZE &&
+        write32(file, COMPILED_LEVEL_VERSION) &&
+        write32(file, level->num_paddles) &&
+        write32(file, level->num_balls) &&
+        write32(file, level->num_holes) &&
+        write32(file, level->num_block_ids) &&
+        write32(file, level->width) &&
+        write32(file, level->height) &&
+        write32(file, offset) &&
+        write32(file, level->powerup_percent);
+
+    for (i = 0; ok && i < level->num_paddles; i++) {
+        ok = write32(file, level->paddles[i].x) &&
+            write32(file, level->paddles[i].y) &&
+            write32(file, level->paddles[i].orientation);
+    }
+
+    for (i = 0; ok && i < level->num_balls; i++) {
+        ok = write32(file, level->balls[i].x) &&
+            write32(file, level->balls[i].y) &&
+            write32(file, level->balls[i].angle);
+    }
+
+    for (i = 0; ok && i < level->num_holes; i++) {
+        ok = write32(file, level->holes[i].x) &&
+            write32(file, level->holes[i].y);
+    }
+
+    for (i = 0, offset = 0; ok && i < level->num_block_ids; i++) {
+        ok = write32(file, level->block_ids[i].id) &&
+            write32(file, offset);
+        offset += strlen(level->block_ids[i].image) + 1;
+    }
+
+    for (i = 0; ok && i < cells; i++) {
+        if (level->cells[i].block == NO_LEVEL_BLOCK) {
+            ok = fputc(COMPILED_NO_BLOCK, file) != EOF;
+        } else {
+            ok = fputc(level->cells[i].block, file) != EOF;
+        }
+    }
+
+    for (i = 0; ok && i < cells; i++) {
+        ok = fputc(level->cells[i].block == NO_LEVEL_BLOCK ? 0 : level->cells[i].hits, file) != EOF;
+    }
+
+    for (i = 0; ok && i < level->num_block_ids; i++) {
+        ok = fwrite(level->block_ids[i].image, 1, strlen(level->block_ids[i].image) + 1, file) ==
+            strlen(level->block_ids[i].image) + 1;
+    }
+
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+
+    return ok;
+}
+
+
+void compiled_level_filename(char *dest, const char *filename, int size)
+{
+    const char *dot;
+    int length;
+
+    dot = strrchr(filename, '.');
+
+    /* A dot in a directory name isn't an extension */
+    if (dot == NULL || strchr(dot, '/') != NULL) {
+        length = strlen(filename);
+    } else {
+        length = dot - filename;
+    }
+
+    if (length > size - (int)strlen(COMPILED_LEVEL_EXTENSION) - 1) {
+        length = size - strlen(COMPILED_LEVEL_EXTENSION) - 1;
+    }
+
+    strncpy(dest, filename, length);
+    dest[length] = '\0';
+    strcat(dest, COMPILED_LEVEL_EXTENSION);
+}
+
+
+/**
+ * Internal function.
+ * Map a file into memory and read it as a level,
+ * either as text or compiled.
+ */
+static LEVEL *map_level_file(const char *filename, int compiled)
+{
+    LEVEL *level;
+    void *data;
+    struct stat info;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "LEVEL: Failed to open \"%s\".\n", filename);
+        return NULL;
+    }
+
+    if (fstat(fd, &info) != 0) {
+        fprintf(stderr, "LEVEL: Failed to open \"%s\".\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    /* An empty file can't be mapped, but it's still a (broken) level */
+    if (info.st_size == 0) {
+        close(fd);
+        return compiled ? read_compiled_level("", 0, filename) : parse_level("", 0, filename);
+    }
+
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "LEVEL: Failed to map \"%s\".\n", filename);
+        return NULL;
+    }
+
+    if (compiled) {
+        level = read_compiled_level(data, info.st_size, filename);
+    } else {
+        level = parse_level(data, info.st_size, filename);
+    }
+
+    munmap(data, info.st_size);
+
+    return level;
+}
+
+
+LEVEL *load_level(const char *filename)
+{
+    LEVEL *level;
+    const void *data;
+    char compiled[LEVEL_STRING_SIZE];
+    struct stat compiled_info;
+    struct stat info;
+    long size;
+
+    compiled_level_filename(compiled, filename, LEVEL_STRING_SIZE);
+
+  /**
+   * Levels in the archive are already in memory.
+   */
+    data = archive_data(compiled, &size);
+
+    if (data != NULL && (level = read_compiled_level(data, size, compiled)) != NULL) {
+        return level;
+    }
+
+    data = archive_data(filename, &size);
+
+    if (data != NULL) {
+        return parse_level(data, size, filename);
+    }
+
+  /**
+   * Only use the compiled level if the level hasn't been
+   * edited since it was compiled.
+   */
+    if (stat(compiled, &compiled_info) == 0 &&
+        (stat(filename, &info) != 0 || compiled_info.st_mtime >= info.st_mtime)) {
+        level = map_level_file(compiled, 1);
+
+        if (level != NULL) {
+            return level;
+        }
+    }
+
+    return map_level_file(filename, 0);
+}
+
+
+void destroy_level(LEVEL *level)
+{
+    if (level) {
+        free_memory("LEVEL CELLS", level->cells);
+    }
+
+    free_memory("LEVEL", level);
+}
@@ -0,0 +1,166 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+
+/**
+ * A level, read out of a level file but not built into a
+ * field yet. Levels are plain data, so they can be loaded by
+ * any thread and don't load any images.
+ *
+ * A level file is made of lines like these:
+ *
+ *   PADDLE x y H|V
+ *   BALL x y angle
+ *   HOLE x y
+ *   BLOCK id type
+ *   POWERUPS percent
+ *   MAP width height
+ *
+ * The type of a BLOCK is the name of a block type, or an image
+ * to use as a plain block (see blocks.h).
+ * MAP is followed by width * height cells. Each cell is a block
+ * id and its hits, such as "F1", or "00" for an empty space.
+ * POWERUPS is the percent of destroyed blocks that drop a
+ * powerup, DEFAULT_LEVEL_POWERUPS if it's left out.
+ * Lines starting with "#" are comments.
+ */
+
+
+#define MAX_LEVEL_PADDLES 10
+#define MAX_LEVEL_BALLS 20
+#define MAX_LEVEL_HOLES 20
+#define MAX_LEVEL_BLOCK_IDS 24
+
+#define MAX_LEVEL_SIZE 4096 /* The widest or tallest map, in blocks */
+#define LEVEL_STRING_SIZE 256
+
+/* A cell without a block */
+#define NO_LEVEL_BLOCK -1
+
+#define DEFAULT_LEVEL_POWERUPS 10
+
+
+/**
+ * A compiled level is a level file turned into binary ahead of
+ * time with the "compile" tool, so it can be loaded without
+ * reading any text. The text file is still the one to edit.
+ *
+ * The file starts with COMPILED_LEVEL_MAGIC, then these 32 bit
+ * little endian numbers: the version, the number of paddles,
+ * balls, holes and block ids, the map width and height, the
+ * size of the string table, and the powerup percent. Then come the paddles (x, y and
+ * orientation), balls (x, y and angle), holes (x and y) and
+ * block ids (id and the offset of its image in the string table),
+ * also as 32 bit numbers. Then the map, as one byte per cell for
+ * the block id index (COMPILED_NO_BLOCK if there isn't a block),
+ * followed by one byte per cell for the hits. Last is the string
+ * table, which is the image filenames ending with zeros.
+ */
+#define COMPILED_LEVEL_MAGIC "BLVL"
+#define COMPILED_LEVEL_MAGIC_SIZE 4
+#define COMPILED_LEVEL_VERSION 2
+#define COMPILED_LEVEL_HEADER_SIZE 40
+#define COMPILED_NO_BLOCK 255
+#define MAX_COMPILED_HITS 255
+
+/* Compiled levels are named after the level, with this extension */
+#define COMPILED_LEVEL_EXTENSION ".lvl"
+
+
+typedef struct LEVEL_PADDLE {
+    int x;
+    int y;
+    char orientation;           /* 'H' for horizontal, 'V' for vertical */
+} LEVEL_PADDLE;
+
+
+typedef struct LEVEL_BALL {
+    int x;
+    int y;
+    int angle;                  /* In degrees */
+} LEVEL_BALL;
+
+
+typedef struct LEVEL_HOLE {
+    int x;
+    int y;
+} LEVEL_HOLE;
+
+
+typedef struct LEVEL_BLOCK_ID {
+    char id;
+    char image[LEVEL_STRING_SIZE];     /* The block type or image */
+    int count;                  /* Number of cells with this block */
+} LEVEL_BLOCK_ID;
+
+
+typedef struct LEVEL_CELL {
+    int block;                  /* Index of the block id, or NO_LEVEL_BLOCK */
+    int hits;
+} LEVEL_CELL;
+
+
+typedef struct LEVEL {
+    LEVEL_PADDLE paddles[MAX_LEVEL_PADDLES];
+    int num_paddles;
+
+    LEVEL_BALL balls[MAX_LEVEL_BALLS];
+    int num_balls;
+
+    LEVEL_HOLE holes[MAX_LEVEL_HOLES];
+    int num_holes;
+
+    LEVEL_BLOCK_ID block_ids[MAX_LEVEL_BLOCK_IDS];
+    int num_block_ids;
+
+    int powerup_percent;        /* Destroyed blocks that drop a powerup */
+
+    /* The map, row by row. NULL if the level has no map */
+    LEVEL_CELL *cells;
+    int width;
+    int height;
+    int num_blocks;             /* Cells with a block that can be hit */
+} LEVEL;
+
+
+/**
+ * Read a level out of memory. The name is only used
+ * in error messages, which give the line and column.
+ * Returns NULL if the level is broken.
+ */
+LEVEL *parse_level(const char *text, long size, const char *name);
+
+/**
+ * Read a compiled level out of memory. The name is only used
+ * in error messages. Returns NULL if it isn't a compiled level,
+ * it's from a different version, or it's broken.
+ */
+LEVEL *read_compiled_level(const char *data, long size, const char *name);
+
+/**
+ * Save a level as a compiled level. Returns false on failure.
+ */
+int save_compiled_level(LEVEL *level, const char *filename);
+
+/**
+ * Get the filename of the compiled version of a level,
+ * such as "data/level01.lvl" for "data/level01.dat".
+ */
+void compiled_level_filename(char *dest, const char *filename, int size);
+
+/**
+ * Load a level file, from the archive if it's open (see
+ * archive.h). The file is mapped into memory instead of
+ * being read. If there's a compiled version of the level
+ * that isn't older than the level, it's used instead.
+ * Returns NULL on failure.
+ */
+LEVEL *load_level(const char *filename);
+
+/**
+ * Free a level.
+ */
+void destroy_level(LEVEL *level);
+
+
+#endif
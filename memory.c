@@ -1,3 +1,4 @@
+#include <allegro5/allegro.h>
 #include <stdio.h>
 
 #include "memory.h"
@@ -18,6 +19,29 @@ static int num_free = 0;
  */
 int show_label = 0;
 
+/**
+ * Memory is allocated by more than one thread. The lock is
+ * created the first time memory is allocated, which has to
+ * happen before any other threads are started.
+ */
+static ALLEGRO_MUTEX *memory_mutex = NULL;
+
+
+/**
+ * Internal function.
+ * Safely change one of the counters.
+ */
+static void count(int *counter)
+{
+    if (memory_mutex == NULL) {
+        memory_mutex = al_create_mutex();
+    }
+
+    al_lock_mutex(memory_mutex);
+    (*counter)++;
+    al_unlock_mutex(memory_mutex);
+}
+
 
 void show_memory_label()
 {
@@ -33,7 +57,7 @@ void *alloc_memory(const char *label, size_t size)
             printf("ALLOC %s \n", label);
         }
 
-        num_alloc++;
+        count(&num_alloc);
     }
 
     /* calloc initializes everything to 0 */
@@ -49,7 +73,7 @@ void *calloc_memory(const char *label, size_t nmemb, size_t size)
             printf("CALLOC %s \n", label);
         }
 
-        num_alloc++;
+        count(&num_alloc);
     }
 
     return calloc(nmemb, size);
@@ -64,7 +88,7 @@ void *free_memory(const char *label, void *ptr)
             printf("FREE %s \n", label);
         }
 
-        num_free++;
+        count(&num_free);
     }
 
     free(ptr);
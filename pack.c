@@ -0,0 +1,157 @@
+/**
+ * Pack the game's files into one archive.
+ *
+ *   pack-tool beeball.pak images/bee.bmp sounds/block.wav ...
+ *
+ * Or run "make pack" to pack everything the game uses.
+ * The files are stored under the names they're given with,
+ * so run it from the game's directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+
+
+typedef struct PACKED_FILE {
+    const char *name;
+    unsigned char *data;
+    long size;
+    long offset;
+} PACKED_FILE;
+
+
+void write32(FILE *file, long n)
+{
+    fputc(n & 0xFF, file);
+    fputc((n >> 8) & 0xFF, file);
+    fputc((n >> 16) & 0xFF, file);
+    fputc((n >> 24) & 0xFF, file);
+}
+
+
+int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const PACKED_FILE *)a)->name, ((const PACKED_FILE *)b)->name);
+}
+
+
+/**
+ * Read a whole file into memory. Returns false on failure.
+ */
+int read_file(PACKED_FILE *packed)
+{
+    FILE *file;
+
+    file = fopen(packed->name, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open \"%s\".\n", packed->name);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    packed->size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    packed->data = malloc(packed->size > 0 ? packed->size : 1);
+
+    if (packed->data == NULL || fread(packed->data, 1, packed->size, file) != (size_t)packed->size) {
+        fprintf(stderr, "Failed to read \"%s\".\n", packed->name);
+        fclose(file);
+        return 0;
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    PACKED_FILE *files;
+    FILE *archive;
+    char name[ARCHIVE_NAME_SIZE];
+    int num_files = argc - 2;
+    long offset;
+    int failed = 0;
+    int i;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s ARCHIVE FILE...\n", argv[0]);
+        return 1;
+    }
+
+    files = calloc(num_files, sizeof(PACKED_FILE));
+
+    if (files == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    for (i = 0; i < num_files; i++) {
+        files[i].name = argv[i + 2];
+
+        if (strlen(files[i].name) >= ARCHIVE_NAME_SIZE) {
+            fprintf(stderr, "The name \"%s\" is too long.\n", files[i].name);
+            failed = 1;
+        } else if (!read_file(&files[i])) {
+            failed = 1;
+        }
+    }
+
+    if (failed) {
+        return 1;
+    }
+
+    /* The game finds files with a binary search */
+    qsort(files, num_files, sizeof(PACKED_FILE), compare_files);
+
+    offset = ARCHIVE_HEADER_SIZE + (long)num_files * ARCHIVE_ENTRY_SIZE;
+
+    for (i = 0; i < num_files; i++) {
+        offset = (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+        files[i].offset = offset;
+        offset += files[i].size;
+    }
+
+    archive = fopen(argv[1], "wb");
+
+    if (archive == NULL) {
+        fprintf(stderr, "Failed to create \"%s\".\n", argv[1]);
+        return 1;
+    }
+
+    fwrite(ARCHIVE_MAGIC, 1, ARCHIVE_MAGIC_SIZE, archive);
+    write32(archive, num_files);
+
+    for (i = 0; i < num_files; i++) {
+        memset(name, 0, ARCHIVE_NAME_SIZE);
+        strcpy(name, files[i].name);
+        fwrite(name, 1, ARCHIVE_NAME_SIZE, archive);
+        write32(archive, files[i].offset);
+        write32(archive, files[i].size);
+    }
+
+    for (i = 0; i < num_files; i++) {
+        while (ftell(archive) < files[i].offset) {
+            fputc(0, archive);
+        }
+        fwrite(files[i].data, 1, files[i].size, archive);
+        free(files[i].data);
+    }
+
+    if (fclose(archive) != 0) {
+        fprintf(stderr, "Failed to write \"%s\".\n", argv[1]);
+        return 1;
+    }
+
+    printf("Packed %d files into %s.\n", num_files, argv[1]);
+
+    free(files);
+
+    return 0;
+}
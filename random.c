@@ -15,3 +15,25 @@ int random_number(int low, int high)
 
     return (rand() % (high - low + 1)) + low;
 }
+
+
+void seed_random(unsigned int seed)
+{
+    srand(seed);
+    init_random_numbers = 1;
+}
+
+
+void seed_random_state(RANDOM *random, unsigned long seed)
+{
+    random->state = seed & 0xFFFFFFFFUL;
+}
+
+
+int next_random_number(RANDOM *random, int low, int high)
+{
+    random->state = (random->state * 1664525UL + 1013904223UL) & 0xFFFFFFFFUL;
+
+    /* The low bits of this kind of generator aren't very random */
+    return (int)((random->state >> 16) % (unsigned long)(high - low + 1)) + low;
+}
@@ -9,5 +9,33 @@
  */
 int random_number(int low, int high);
 
+/**
+ * Always generate the same random numbers, for benchmarks
+ * and tests. Without a seed, the numbers are different
+ * every time the game is played.
+ */
+void seed_random(unsigned int seed);
+
+
+/**
+ * A random number generator with its own state, so a thread
+ * can make random numbers without touching the shared ones.
+ * The same seed always makes the same numbers.
+ */
+typedef struct RANDOM {
+    unsigned long state;
+} RANDOM;
+
+/**
+ * Start a generator from a seed.
+ */
+void seed_random_state(RANDOM *random, unsigned long seed);
+
+/**
+ * Generate a random number between low and high, inclusively,
+ * from a generator's own state.
+ */
+int next_random_number(RANDOM *random, int low, int high);
+
 
 #endif
@@ -1,35 +1,271 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <malloc.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "archive.h"
+#include "baked.h"
 #include "resource.h"
+#include "workers.h"
 
 
 #define MAX_RESOURCE_PATHS 4
-#define MAX_BITMAP_RESOURCES 50
 #define MAX_RESOURCE_FILENAME_SIZE 256
 
+/* The tables grow as more images are loaded */
+#define INITIAL_BITMAP_RESOURCES 64
+
+#define EMPTY_SLOT -1
+
 
 typedef struct {
     char name[MAX_RESOURCE_FILENAME_SIZE];
-    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_BITMAP *bitmap;     /* NULL if it isn't loaded */
+    long bytes;
+    int missing;                /* Is true if the file couldn't be found */
+    int loading;                /* Is true while a worker is loading it */
+    int unconverted;            /* Is true if it's in memory instead of video memory */
+    ALLEGRO_BITMAP *reloaded;   /* A new version of the file, waiting to be copied in */
+
+    int refs;                   /* Number of times it has been acquired */
+    unsigned long released;     /* The stamp when it was last released or borrowed */
+    unsigned long last_used;
 } BITMAP_RESOURCE;
 
 
-static BITMAP_RESOURCE *bitmap_resources[MAX_BITMAP_RESOURCES];
+static BITMAP_RESOURCE *bitmap_resources = NULL;
 static int num_bitmap_resources = 0;
+static int max_bitmap_resources = 0;
+
+/**
+ * Hash tables of positions in the list of resources, one
+ * looked up by filename and one looked up by bitmap.
+ * The tables are always at least twice as big as the list.
+ */
+static int *name_table = NULL;
+static int *bitmap_table = NULL;
+static int table_size = 0;
 
-static char resource_paths[MAX_RESOURCE_FILENAME_SIZE][MAX_RESOURCE_PATHS];
+static char resource_paths[MAX_RESOURCE_PATHS][MAX_RESOURCE_FILENAME_SIZE];
 static int num_resource_paths = 0;
 
+static long resource_budget = DEFAULT_RESOURCE_BUDGET;
+static unsigned long resource_stamp = 0;
+static unsigned long use_clock = 0;
 
-void init_resources()
+static RESOURCE_STATS stats;
+
+/* Number of images loaded into memory instead of video memory */
+static int unconverted_resources = 0;
+
+/* Number of images waiting for their new version to be copied in */
+static int reloaded_resources = 0;
+
+/* Resources are loaded by more than one thread */
+static ALLEGRO_MUTEX *resource_mutex = NULL;
+
+
+/**
+ * Internal function.
+ */
+static unsigned long hash_name(const char *name)
+{
+    unsigned long hash = 5381;
+
+    while (*name) {
+        hash = (hash * 33) ^ (unsigned char)*name++;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Internal function.
+ */
+static unsigned long hash_bitmap(ALLEGRO_BITMAP *bitmap)
+{
+    unsigned long hash = (unsigned long)bitmap;
+
+    return (hash >> 4) * 2654435761UL;
+}
+
+
+/**
+ * Internal function.
+ * Find a resource by filename, or return EMPTY_SLOT.
+ */
+static int find_name(const char *name)
+{
+    int slot;
+    int i;
+
+    if (table_size == 0) {
+        return EMPTY_SLOT;
+    }
+
+    slot = hash_name(name) & (table_size - 1);
+
+    while ((i = name_table[slot]) != EMPTY_SLOT) {
+        if (strcmp(bitmap_resources[i].name, name) == 0) {
+            return i;
+        }
+        slot = (slot + 1) & (table_size - 1);
+    }
+
+    return EMPTY_SLOT;
+}
+
+
+/**
+ * Internal function.
+ * Find a resource by bitmap, or return EMPTY_SLOT.
+ */
+static int find_bitmap(ALLEGRO_BITMAP *bitmap)
 {
+    int slot;
     int i;
 
-    for (i = 0; i < MAX_BITMAP_RESOURCES; i++) {
-        bitmap_resources[i] = NULL;
+    if (table_size == 0 || bitmap == NULL) {
+        return EMPTY_SLOT;
     }
+
+    slot = hash_bitmap(bitmap) & (table_size - 1);
+
+    while ((i = bitmap_table[slot]) != EMPTY_SLOT) {
+        if (bitmap_resources[i].bitmap == bitmap) {
+            return i;
+        }
+        slot = (slot + 1) & (table_size - 1);
+    }
+
+    return EMPTY_SLOT;
+}
+
+
+/**
+ * Internal function.
+ * Put a resource in the filename table.
+ */
+static void index_name(int i)
+{
+    int slot = hash_name(bitmap_resources[i].name) & (table_size - 1);
+
+    while (name_table[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & (table_size - 1);
+    }
+
+    name_table[slot] = i;
+}
+
+
+/**
+ * Internal function.
+ * Put a resource in the bitmap table.
+ */
+static void index_bitmap(int i)
+{
+    int slot = hash_bitmap(bitmap_resources[i].bitmap) & (table_size - 1);
+
+    while (bitmap_table[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & (table_size - 1);
+    }
+
+    bitmap_table[slot] = i;
+}
+
+
+/**
+ * Internal function.
+ * Fill the hash tables from the list of resources.
+ */
+static void rebuild_tables()
+{
+    int i;
+
+    for (i = 0; i < table_size; i++) {
+        name_table[i] = EMPTY_SLOT;
+        bitmap_table[i] = EMPTY_SLOT;
+    }
+
+    for (i = 0; i < num_bitmap_resources; i++) {
+        index_name(i);
+
+        if (bitmap_resources[i].bitmap != NULL) {
+            index_bitmap(i);
+        }
+    }
+}
+
+
+/**
+ * Internal function.
+ * Make room for one more resource. Returns false if
+ * there isn't enough memory.
+ */
+static int grow_resources()
+{
+    BITMAP_RESOURCE *resources;
+    int *names;
+    int *bitmaps;
+    int size;
+
+    if (num_bitmap_resources < max_bitmap_resources) {
+        return 1;
+    }
+
+    size = max_bitmap_resources ? max_bitmap_resources * 2 : INITIAL_BITMAP_RESOURCES;
+
+    resources = realloc(bitmap_resources, size * sizeof(BITMAP_RESOURCE));
+    names = malloc(size * 2 * sizeof(int));
+    bitmaps = malloc(size * 2 * sizeof(int));
+
+    if (resources != NULL) {
+        bitmap_resources = resources;
+    }
+
+    if (resources == NULL || names == NULL || bitmaps == NULL) {
+        free(names);
+        free(bitmaps);
+        fprintf(stderr, "RESOURCES: Failed to make room for more resources.\n");
+        return 0;
+    }
+
+    free(name_table);
+    free(bitmap_table);
+    name_table = names;
+    bitmap_table = bitmaps;
+    table_size = size * 2;
+    max_bitmap_resources = size;
+
+    rebuild_tables();
+
+    return 1;
+}
+
+
+void init_resources()
+{
+    bitmap_resources = NULL;
+    num_bitmap_resources = 0;
+    max_bitmap_resources = 0;
+
+    name_table = NULL;
+    bitmap_table = NULL;
+    table_size = 0;
+
+    resource_budget = DEFAULT_RESOURCE_BUDGET;
+    resource_stamp = 0;
+    use_clock = 0;
+    unconverted_resources = 0;
+    reloaded_resources = 0;
+
+    memset(&stats, 0, sizeof(stats));
+
+    resource_mutex = al_create_mutex();
 }
 
 
@@ -38,14 +274,27 @@ void stop_resources()
     int i;
 
     for (i = 0; i < num_bitmap_resources; i++) {
-        if (bitmap_resources[i] != NULL) {
-            al_destroy_bitmap(bitmap_resources[i]->bitmap);
-            free(bitmap_resources[i]);
-            bitmap_resources[i] = NULL;
+        if (bitmap_resources[i].refs > 0) {
+            fprintf(stderr, "RESOURCES: \"%s\" was never released.\n",
+                    bitmap_resources[i].name);
         }
+        al_destroy_bitmap(bitmap_resources[i].bitmap);
+        al_destroy_bitmap(bitmap_resources[i].reloaded);
     }
 
+    free(bitmap_resources);
+    free(name_table);
+    free(bitmap_table);
+
+    bitmap_resources = NULL;
     num_bitmap_resources = 0;
+    max_bitmap_resources = 0;
+    name_table = NULL;
+    bitmap_table = NULL;
+    table_size = 0;
+
+    al_destroy_mutex(resource_mutex);
+    resource_mutex = NULL;
 }
 
 
@@ -87,72 +336,759 @@ ALLEGRO_BITMAP *load_bitmap_with_magic_pink(const char *filename)
 
 /**
  * Internal function.
- * Create a BITMAP_RESOURCE structure.
+ * Build the filename of a resource in one of the places
+ * resources are kept. Place 0 is the current directory and
+ * the rest are the resource paths.
+ */
+static void resource_location(char *fullpath, int place, const char *name)
+{
+    strcpy(fullpath, "");
+
+    if (place > 0) {
+        strncat(fullpath, resource_paths[place - 1], MAX_RESOURCE_FILENAME_SIZE - 1);
+    }
+
+    strncat(fullpath, name, MAX_RESOURCE_FILENAME_SIZE - strlen(fullpath) - 1);
+}
+
+
+/**
+ * Internal function.
+ * Load an image out of the archive, using the baked
+ * version if there is one.
+ */
+static ALLEGRO_BITMAP *load_archived_image(const char *filename)
+{
+    ALLEGRO_BITMAP *bitmap = NULL;
+    ALLEGRO_FILE *file;
+    char baked[MAX_RESOURCE_FILENAME_SIZE];
+
+    baked_filename(baked, filename, MAX_RESOURCE_FILENAME_SIZE);
+
+    file = open_archive_file(baked);
+
+    if (file != NULL) {
+        bitmap = load_baked_bitmap_f(file);
+        al_fclose(file);
+    }
+
+    if (bitmap == NULL) {
+        file = open_archive_file(filename);
+
+        if (file == NULL) {
+            return NULL;
+        }
+
+        bitmap = al_load_bitmap_f(file, strrchr(filename, '.'));
+        al_fclose(file);
+
+        if (bitmap != NULL) {
+            al_convert_mask_to_alpha(bitmap, al_map_rgb(255, 0, 255));
+        }
+    }
+
+    return bitmap;
+}
+
+
+/**
+ * Internal function.
+ * Load an image, using the baked version if there is one
+ * and the image hasn't been edited since it was baked.
+ */
+static ALLEGRO_BITMAP *load_image_file(const char *filename)
+{
+    ALLEGRO_BITMAP *bitmap = NULL;
+    struct stat baked_info;
+    struct stat info;
+    char baked[MAX_RESOURCE_FILENAME_SIZE];
+
+    baked_filename(baked, filename, MAX_RESOURCE_FILENAME_SIZE);
+
+    if (stat(baked, &baked_info) == 0 &&
+        (stat(filename, &info) != 0 || baked_info.st_mtime >= info.st_mtime)) {
+        bitmap = load_baked_bitmap(baked);
+    }
+
+    if (bitmap == NULL) {
+        return load_bitmap_with_magic_pink(filename);
+    }
+
+    return bitmap;
+}
+
+
+/**
+ * Internal function.
+ * Load an image from the archive, the current directory
+ * or the resource paths. This doesn't touch the list of
+ * resources, so it can be called without locking.
+ */
+static ALLEGRO_BITMAP *decode_image(const char *name)
+{
+    ALLEGRO_BITMAP *bitmap = NULL;
+    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+    int j;
+
+  /**
+   * Look in the archive first, since that doesn't
+   * need to open any files.
+   */
+    for (j = 0; bitmap == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        bitmap = load_archived_image(fullpath);
+    }
+
+  /**
+   * Try the current working directory and then
+   * the list of resource paths.
+   */
+    for (j = 0; bitmap == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        bitmap = load_image_file(fullpath);
+    }
+
+    if (bitmap == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to load resource: \"%s\".\n", name);
+    }
+
+    return bitmap;
+}
+
+
+/**
+ * Internal function.
+ * Give a resource the bitmap that was loaded for it.
+ */
+static void store_bitmap_resource(int i, ALLEGRO_BITMAP *bitmap)
+{
+    BITMAP_RESOURCE *resource = &bitmap_resources[i];
+
+    if (bitmap == NULL) {
+        resource->missing = 1;
+        return;
+    }
+
+  /**
+   * Images loaded by a thread without a display are kept in
+   * memory until the thread with the display converts them.
+   */
+    if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) && !resource->unconverted) {
+        resource->unconverted = 1;
+        unconverted_resources++;
+    }
+
+    resource->bitmap = bitmap;
+    resource->bytes = (long)al_get_bitmap_width(bitmap) * al_get_bitmap_height(bitmap) * 4;
+
+    index_bitmap(i);
+
+    stats.bytes += resource->bytes;
+    stats.count++;
+    if (stats.bytes > stats.peak_bytes) {
+        stats.peak_bytes = stats.bytes;
+    }
+}
+
+
+/**
+ * Internal function.
+ * Find or add a resource, without locking.
  */
-BITMAP_RESOURCE *load_bitmap_resource(const char *name,
-                                      ALLEGRO_BITMAP * bitmap)
+static int find_resource(const char *name)
 {
     BITMAP_RESOURCE *resource;
+    int i;
+
+    i = find_name(name);
 
-    resource = malloc(sizeof(BITMAP_RESOURCE));
-    if (resource != NULL) {
-        strcpy(resource->name, name);
-        resource->bitmap = bitmap;
+    if (i != EMPTY_SLOT) {
+        return i;
     }
 
-    return resource;
+    if (!grow_resources()) {
+        return EMPTY_SLOT;
+    }
+
+    i = num_bitmap_resources++;
+    resource = &bitmap_resources[i];
+
+    strncpy(resource->name, name, MAX_RESOURCE_FILENAME_SIZE - 1);
+    resource->name[MAX_RESOURCE_FILENAME_SIZE - 1] = '\0';
+    resource->bitmap = NULL;
+    resource->bytes = 0;
+    resource->missing = 0;
+    resource->loading = 0;
+    resource->unconverted = 0;
+    resource->reloaded = NULL;
+    resource->refs = 0;
+    resource->released = 0;
+    resource->last_used = 0;
+
+    /* The tables are big enough, since they grow with the list */
+    index_name(i);
+
+    return i;
 }
 
 
+/**
+ * Internal function.
+ * Get the bitmap of a resource, loading it if it has
+ * never been loaded or if it was thrown out.
+ */
+static ALLEGRO_BITMAP *use_resource(int i)
+{
+    BITMAP_RESOURCE *resource;
+
+    if (i < 0 || i >= num_bitmap_resources) {
+        return NULL;
+    }
+
+    resource = &bitmap_resources[i];
+
+    if (resource->bitmap != NULL) {
+        stats.hits++;
+    } else if (!resource->missing) {
+        stats.misses++;
+        store_bitmap_resource(i, decode_image(resource->name));
+    }
+
+    resource->last_used = ++use_clock;
+
+    /* A borrowed image can end up in the next snapshot */
+    resource->released = resource_stamp;
+
+    return resource->bitmap;
+}
+
 
 ALLEGRO_BITMAP *load_resource_image(const char *name)
 {
     ALLEGRO_BITMAP *bitmap;
-    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+
+    al_lock_mutex(resource_mutex);
+    bitmap = use_resource(find_resource(name));
+    al_unlock_mutex(resource_mutex);
+
+    return bitmap;
+}
+
+
+ALLEGRO_BITMAP *acquire_resource_image(const char *name)
+{
+    return acquire_resource_images(name, 1);
+}
+
+
+ALLEGRO_BITMAP *acquire_resource_images(const char *name, int count)
+{
+    ALLEGRO_BITMAP *bitmap;
+    int i;
+
+    al_lock_mutex(resource_mutex);
+
+    i = find_resource(name);
+    bitmap = use_resource(i);
+
+    if (bitmap != NULL) {
+        bitmap_resources[i].refs += count;
+    }
+
+    al_unlock_mutex(resource_mutex);
+
+    return bitmap;
+}
+
+
+void release_resource_image(ALLEGRO_BITMAP *bitmap)
+{
+    int i;
+
+    if (bitmap == NULL) {
+        return;
+    }
+
+    al_lock_mutex(resource_mutex);
+
+    i = find_bitmap(bitmap);
+
+    if (i == EMPTY_SLOT || bitmap_resources[i].refs <= 0) {
+        fprintf(stderr, "RESOURCES: Released an image that wasn't acquired.\n");
+    } else {
+        bitmap_resources[i].refs--;
+        bitmap_resources[i].released = resource_stamp;
+    }
+
+    al_unlock_mutex(resource_mutex);
+}
+
+
+RESOURCE_HANDLE find_resource_handle(const char *name)
+{
     int i;
 
+    al_lock_mutex(resource_mutex);
+    i = find_resource(name);
+    use_resource(i);
+    al_unlock_mutex(resource_mutex);
+
+    return i;
+}
+
+
+ALLEGRO_BITMAP *resource_handle_image(RESOURCE_HANDLE handle)
+{
+    ALLEGRO_BITMAP *bitmap;
+
+    al_lock_mutex(resource_mutex);
+    bitmap = use_resource(handle);
+    al_unlock_mutex(resource_mutex);
+
+    return bitmap;
+}
+
+
+/**
+ * Internal function.
+ * Load an image on a worker thread.
+ */
+static void preload_job(void *data)
+{
+    ALLEGRO_BITMAP *bitmap;
+    char *name = data;
+    int skip;
+    int i;
+
+    al_lock_mutex(resource_mutex);
+
+    i = find_resource(name);
+    skip = (i == EMPTY_SLOT || bitmap_resources[i].bitmap != NULL ||
+            bitmap_resources[i].missing || bitmap_resources[i].loading);
+
+    if (!skip) {
+        bitmap_resources[i].loading = 1;
+        stats.misses++;
+    }
+
+    al_unlock_mutex(resource_mutex);
+
+    if (!skip) {
+
+      /**
+       * The slow part happens without the lock, so the
+       * other workers can load images at the same time.
+       */
+        bitmap = decode_image(name);
+
+        al_lock_mutex(resource_mutex);
+
+        bitmap_resources[i].loading = 0;
+
+        /* Somebody needed it right away and loaded it themselves */
+        if (bitmap_resources[i].bitmap != NULL) {
+            al_destroy_bitmap(bitmap);
+        } else {
+            store_bitmap_resource(i, bitmap);
+        }
+
+        al_unlock_mutex(resource_mutex);
+    }
+
+    free(name);
+}
+
+
+void preload_resource_image(const char *name)
+{
+    preload_resource_image_group(NULL, name);
+}
+
+
+void preload_resource_image_group(JOB_GROUP *group, const char *name)
+{
+    char *copy;
+
+    copy = malloc(strlen(name) + 1);
+
+    if (copy != NULL) {
+        strcpy(copy, name);
+        add_group_job(group, preload_job, copy);
+    }
+}
+
+
+int preload_resource_manifest(const char *filename)
+{
+    FILE *file;
+    char line[MAX_RESOURCE_FILENAME_SIZE];
+    int count = 0;
+
+    file = open_resource_stream(filename);
+
+    if (file == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to open manifest \"%s\".\n", filename);
+        return -1;
+    }
+
+    while (fscanf(file, "%255s", line) == 1) {
+
+        /* Skip comments */
+        if (line[0] == '#') {
+            fscanf(file, "%*[^\n]");
+            continue;
+        }
+
+        preload_resource_image(line);
+        count++;
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+
+ALLEGRO_SAMPLE *load_resource_sample(const char *name)
+{
+    ALLEGRO_SAMPLE *sample = NULL;
+    ALLEGRO_FILE *file;
+    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+    int j;
+
+    for (j = 0; sample == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        file = open_archive_file(fullpath);
+        if (file != NULL) {
+            sample = al_load_sample_f(file, strrchr(fullpath, '.'));
+            al_fclose(file);
+        }
+    }
+
+    for (j = 0; sample == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        sample = al_load_sample(fullpath);
+    }
+
+    if (sample == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to load sound: \"%s\".\n", name);
+    }
+
+    return sample;
+}
+
+
+ALLEGRO_AUDIO_STREAM *load_resource_audio_stream(const char *name,
+                                                 int buffers, int samples)
+{
+    ALLEGRO_AUDIO_STREAM *stream = NULL;
+    ALLEGRO_FILE *file;
+    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+    int j;
+
   /**
-   * Try to find the resource in the list of
-   * resources that have already been loaded.
+   * The stream keeps reading the file while it plays,
+   * so the file is only closed if the stream failed.
    */
+    for (j = 0; stream == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        file = open_archive_file(fullpath);
+        if (file != NULL) {
+            stream = al_load_audio_stream_f(file, strrchr(fullpath, '.'), buffers, samples);
+            if (stream == NULL) {
+                al_fclose(file);
+            }
+        }
+    }
+
+    for (j = 0; stream == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        stream = al_load_audio_stream(fullpath, buffers, samples);
+    }
+
+    if (stream == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to load music: \"%s\".\n", name);
+    }
+
+    return stream;
+}
+
+
+FILE *open_resource_stream(const char *name)
+{
+    FILE *stream = NULL;
+    const void *data;
+    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+    long size;
+    int j;
+
+    for (j = 0; stream == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        data = archive_data(fullpath, &size);
+        if (data != NULL) {
+            /* The stream is only read from, so it won't write to the archive */
+            stream = fmemopen((void *)data, size, "r");
+        }
+    }
+
+    for (j = 0; stream == NULL && j <= num_resource_paths; j++) {
+        resource_location(fullpath, j, name);
+        stream = fopen(fullpath, "r");
+    }
+
+    return stream;
+}
+
+
+/**
+ * Internal function.
+ * Find the resource that was loaded from a file, or
+ * from the baked version of the file.
+ */
+static int find_resource_file(const char *filename)
+{
+    char fullpath[MAX_RESOURCE_FILENAME_SIZE];
+    char baked[MAX_RESOURCE_FILENAME_SIZE];
+    int i;
+    int j;
+
     for (i = 0; i < num_bitmap_resources; i++) {
-        if (strncmp
-            (bitmap_resources[i]->name, name,
-             MAX_RESOURCE_FILENAME_SIZE) == 0) {
-            /*printf("Found resource %s\n", name); */
-            return bitmap_resources[i]->bitmap;
+        for (j = 0; j <= num_resource_paths; j++) {
+            resource_location(fullpath, j, bitmap_resources[i].name);
+
+            if (strcmp(fullpath, filename) == 0) {
+                return i;
+            }
+
+            baked_filename(baked, fullpath, MAX_RESOURCE_FILENAME_SIZE);
+
+            if (strcmp(baked, filename) == 0) {
+                return i;
+            }
         }
     }
 
+    return EMPTY_SLOT;
+}
+
+
+int reload_resource_image(const char *filename)
+{
+    BITMAP_RESOURCE *resource;
+    ALLEGRO_BITMAP *bitmap;
+    const char *extension;
+    int i;
+
+    al_lock_mutex(resource_mutex);
+    i = find_resource_file(filename);
+    al_unlock_mutex(resource_mutex);
+
+    if (i == EMPTY_SLOT) {
+        return 0;
+    }
+
   /**
-   * Try the current working directory.
+   * Load the file that changed, even if there's a baked
+   * version of it that would normally be used instead.
    */
-    bitmap = load_bitmap_with_magic_pink(name);
-    if (bitmap != NULL) {
-        /*printf("Found resource in current directory %s\n", name); */
-        bitmap_resources[num_bitmap_resources] =
-            load_bitmap_resource(name, bitmap);
-        num_bitmap_resources++;
-        return bitmap;
+    extension = strrchr(filename, '.');
+
+    if (extension != NULL && strcmp(extension, BAKED_EXTENSION) == 0) {
+        bitmap = load_baked_bitmap(filename);
+    } else {
+        bitmap = load_bitmap_with_magic_pink(filename);
     }
 
+    if (bitmap == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to reload \"%s\".\n", filename);
+        return 0;
+    }
+
+    al_lock_mutex(resource_mutex);
+
+    resource = &bitmap_resources[i];
+
+    if (resource->reloaded != NULL) {
+        al_destroy_bitmap(resource->reloaded);
+    } else {
+        reloaded_resources++;
+    }
+
+    resource->reloaded = bitmap;
+
+    al_unlock_mutex(resource_mutex);
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ * Copy the new version of an image into the old one, so
+ * everything holding on to the image sees the change.
+ */
+static void copy_reloaded_image(BITMAP_RESOURCE *resource)
+{
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    ALLEGRO_BITMAP *bitmap = resource->bitmap;
+    ALLEGRO_BITMAP *reloaded = resource->reloaded;
+
+    resource->reloaded = NULL;
+
   /**
-   * Try finding it in the list of resource paths.
+   * If the image was thrown out, the new version will
+   * be loaded the next time the image is used.
    */
-    for (i = 0; i < num_resource_paths; i++) {
-        strcpy(fullpath, "");
-        strncat(fullpath, resource_paths[i], MAX_RESOURCE_FILENAME_SIZE);
-        strncat(fullpath, name, MAX_RESOURCE_FILENAME_SIZE);
-        bitmap = load_bitmap_with_magic_pink(fullpath);
-        if (bitmap != NULL) {
-            /*printf("Found resource in resource path %s %s\n", resource_paths[i], name); */
-            bitmap_resources[num_bitmap_resources] =
-                load_bitmap_resource(name, bitmap);
-            num_bitmap_resources++;
-            return bitmap;
+    if (bitmap == NULL) {
+        al_destroy_bitmap(reloaded);
+        return;
+    }
+
+    if (al_get_bitmap_width(bitmap) != al_get_bitmap_width(reloaded) ||
+        al_get_bitmap_height(bitmap) != al_get_bitmap_height(reloaded)) {
+        fprintf(stderr, "RESOURCES: \"%s\" changed size, restart to see it.\n",
+                resource->name);
+        al_destroy_bitmap(reloaded);
+        return;
+    }
+
+    al_set_target_bitmap(bitmap);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_draw_bitmap(reloaded, 0, 0, 0);
+    al_set_target_bitmap(target);
+
+    al_destroy_bitmap(reloaded);
+}
+
+
+void convert_resources()
+{
+    BITMAP_RESOURCE *resource;
+    int i;
+
+    al_lock_mutex(resource_mutex);
+
+  /**
+   * Only convert the images that are finished loading. Workers
+   * might be in the middle of loading other memory bitmaps.
+   */
+    for (i = 0; unconverted_resources > 0 && i < num_bitmap_resources; i++) {
+        resource = &bitmap_resources[i];
+
+        if (resource->unconverted) {
+            resource->unconverted = 0;
+            unconverted_resources--;
+
+            if (resource->bitmap != NULL) {
+                al_convert_bitmap(resource->bitmap);
+            }
         }
     }
 
-    fprintf(stderr, "RESOURCES: Failed to load resource: \"%s\".\n", name);
-    return NULL;
+    for (i = 0; reloaded_resources > 0 && i < num_bitmap_resources; i++) {
+        resource = &bitmap_resources[i];
+
+        if (resource->reloaded != NULL) {
+            reloaded_resources--;
+            copy_reloaded_image(resource);
+        }
+    }
+
+    al_unlock_mutex(resource_mutex);
+}
+
+
+void set_resource_budget(long bytes)
+{
+    al_lock_mutex(resource_mutex);
+    resource_budget = bytes;
+    al_unlock_mutex(resource_mutex);
+}
+
+
+void set_resource_stamp(unsigned long stamp)
+{
+    al_lock_mutex(resource_mutex);
+    resource_stamp = stamp;
+    al_unlock_mutex(resource_mutex);
+}
+
+
+/**
+ * Internal function.
+ * Sort resources by when they were last used, oldest first.
+ */
+static int compare_last_used(const void *a, const void *b)
+{
+    unsigned long used_a = bitmap_resources[*(const int *)a].last_used;
+    unsigned long used_b = bitmap_resources[*(const int *)b].last_used;
+
+    return used_a < used_b ? -1 : used_a > used_b;
+}
+
+
+void trim_resources(unsigned long drawn)
+{
+    BITMAP_RESOURCE *resource;
+    int *unused;
+    int num_unused = 0;
+    int evicted = 0;
+    int i;
+
+    al_lock_mutex(resource_mutex);
+
+    if (stats.bytes <= resource_budget) {
+        al_unlock_mutex(resource_mutex);
+        return;
+    }
+
+    unused = malloc(num_bitmap_resources * sizeof(int));
+
+    if (unused == NULL) {
+        fprintf(stderr, "RESOURCES: Failed to make room to trim the images.\n");
+        al_unlock_mutex(resource_mutex);
+        return;
+    }
+
+    /* Find the images that nothing is holding on to, or might still draw */
+    for (i = 0; i < num_bitmap_resources; i++) {
+        resource = &bitmap_resources[i];
+
+        if (resource->bitmap != NULL && resource->refs == 0 &&
+            resource->released <= drawn) {
+            unused[num_unused++] = i;
+        }
+    }
+
+    qsort(unused, num_unused, sizeof(int), compare_last_used);
+
+    /* Throw out the ones that were used the longest time ago first */
+    for (i = 0; i < num_unused && stats.bytes > resource_budget; i++) {
+        resource = &bitmap_resources[unused[i]];
+
+        al_destroy_bitmap(resource->bitmap);
+        resource->bitmap = NULL;
+
+        stats.bytes -= resource->bytes;
+        stats.count--;
+        stats.evictions++;
+        evicted++;
+    }
+
+    free(unused);
+
+    /* Take the thrown out images out of the bitmap table */
+    if (evicted > 0) {
+        rebuild_tables();
+    }
+
+    al_unlock_mutex(resource_mutex);
+}
+
+
+void get_resource_stats(RESOURCE_STATS *resource_stats)
+{
+    al_lock_mutex(resource_mutex);
+    *resource_stats = stats;
+    al_unlock_mutex(resource_mutex);
 }
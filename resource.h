@@ -2,7 +2,39 @@
 #define RESOURCE_H
 
 
+#include <stdio.h>
 #include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+
+#include "workers.h"
+
+
+/**
+ * A handle to a resource. Looking up an image by its handle
+ * is faster than looking it up by its filename. A handle stays
+ * valid until the resource library is stopped, even if the
+ * image is thrown out of memory in the meantime.
+ */
+typedef int RESOURCE_HANDLE;
+
+#define NO_RESOURCE -1
+
+
+/**
+ * How much memory the images are allowed to use before
+ * unused images are thrown out, in bytes.
+ */
+#define DEFAULT_RESOURCE_BUDGET (64 * 1024 * 1024)
+
+
+typedef struct RESOURCE_STATS {
+    unsigned long hits;         /* Images that were already loaded */
+    unsigned long misses;       /* Images that had to be loaded */
+    unsigned long evictions;    /* Images thrown out to save memory */
+    long bytes;                 /* Memory used by the loaded images */
+    long peak_bytes;
+    int count;                  /* Number of images that are loaded */
+} RESOURCE_STATS;
 
 
 /**
@@ -22,6 +54,9 @@ void stop_resources();
  * search the paths until it finds it. The only
  * resource path by default is the current
  * directory.
+ *
+ * If an archive is open (see archive.h), the
+ * paths are searched in the archive first.
  */
 void add_resource_path(const char *path);
 
@@ -30,8 +65,127 @@ void add_resource_path(const char *path);
  * It will return the first instance of the filename
  * in order of the paths that you added. If the
  * resource isn't found it will return NULL.
+ *
+ * The image is borrowed, so it can be thrown out by
+ * trim_resources. Only keep it for as long as the
+ * current frame.
  */
 ALLEGRO_BITMAP *load_resource_image(const char *filename);
 
+/**
+ * Load an image and keep it in memory until it is released.
+ * Every image that is acquired must be released once.
+ */
+ALLEGRO_BITMAP *acquire_resource_image(const char *filename);
+
+/**
+ * Acquire an image a number of times at once, such as once
+ * for every block on a map that uses it. It still has to be
+ * released once for every time it was acquired.
+ */
+ALLEGRO_BITMAP *acquire_resource_images(const char *filename, int count);
+
+/**
+ * Let go of an image that was acquired.
+ */
+void release_resource_image(ALLEGRO_BITMAP *bitmap);
+
+/**
+ * Get a handle to an image, loading it if needed.
+ */
+RESOURCE_HANDLE find_resource_handle(const char *filename);
+
+/**
+ * Get the image of a handle. The image is borrowed,
+ * just like with load_resource_image.
+ */
+ALLEGRO_BITMAP *resource_handle_image(RESOURCE_HANDLE handle);
+
+/**
+ * Start loading an image on a worker thread (see workers.h),
+ * so it's ready before it's needed. Call wait_for_jobs to
+ * wait until every image is loaded.
+ */
+void preload_resource_image(const char *filename);
+
+/**
+ * Start loading an image as part of a job group, so only
+ * the images in the group have to be waited for.
+ */
+void preload_resource_image_group(JOB_GROUP *group, const char *filename);
+
+/**
+ * Start loading every image listed in a manifest file.
+ * The manifest has one image filename per line, and lines
+ * starting with "#" are comments.
+ * Returns the number of images, or -1 on failure.
+ */
+int preload_resource_manifest(const char *filename);
+
+/**
+ * Load a sound, looking for it the same way as images.
+ * Sounds aren't kept by the resource library, so destroy
+ * it when you're done with it. Returns NULL on failure.
+ */
+ALLEGRO_SAMPLE *load_resource_sample(const char *filename);
+
+/**
+ * Open a sound to be streamed instead of loaded all at once,
+ * looking for it the same way as images. It's decoded a few
+ * buffers at a time as it plays. Destroy it when you're done
+ * with it. Returns NULL on failure.
+ */
+ALLEGRO_AUDIO_STREAM *load_resource_audio_stream(const char *filename,
+                                                 int buffers, int samples);
+
+/**
+ * Open a text file, looking for it the same way as images.
+ * Close it with fclose. Returns NULL on failure.
+ */
+FILE *open_resource_stream(const char *filename);
+
+/**
+ * Images that are loaded by a thread without a display
+ * are kept in memory. Call this from the thread that owns
+ * the display to move them into video memory.
+ */
+void convert_resources();
+
+/**
+ * Load an image again because its file changed, such as
+ * "images/bee1.bmp" or "images/bee1.bake". The new version is
+ * copied into the old image by convert_resources, so pointers
+ * to the image stay valid. Images that changed size are skipped.
+ * Returns false if the file isn't a loaded image.
+ */
+int reload_resource_image(const char *filename);
+
+/**
+ * Set the memory budget for images, in bytes.
+ */
+void set_resource_budget(long bytes);
+
+/**
+ * Images that are released are marked with the stamp.
+ * Set it to the number of the next frame that will be
+ * drawn, before updating the game.
+ */
+void set_resource_stamp(unsigned long stamp);
+
+/**
+ * If the images are using more memory than the budget, throw
+ * out the least recently used images that aren't acquired.
+ * Images released or borrowed after the frame that was drawn
+ * are kept, since they might still be in a snapshot.
+ *
+ * Only call this from the thread that draws, after drawing.
+ */
+void trim_resources(unsigned long drawn);
+
+/**
+ * Get the hits, misses and memory use of the images.
+ */
+void get_resource_stats(RESOURCE_STATS *stats);
+
 
 #endif
@@ -0,0 +1,142 @@
+#include <allegro5/allegro.h>
+
+#include "snapshot.h"
+
+
+struct SNAPSHOTS {
+    void *slots[NUM_SNAPSHOTS];
+    unsigned long seqs[NUM_SNAPSHOTS];
+
+    int write;                  /* The slot being written */
+    int ready;                  /* The newest finished slot */
+    int read;                   /* The slot being drawn */
+    int fresh;                  /* Is true if the ready slot hasn't been read */
+
+    unsigned long next_seq;
+    unsigned long consumed;
+    int stopped;
+
+    ALLEGRO_MUTEX *mutex;
+    ALLEGRO_COND *cond;
+};
+
+
+SNAPSHOTS *create_snapshots(void *slots[NUM_SNAPSHOTS])
+{
+    SNAPSHOTS *snapshots;
+    int i;
+
+    snapshots = malloc(sizeof(SNAPSHOTS));
+
+    if (snapshots != NULL) {
+        for (i = 0; i < NUM_SNAPSHOTS; i++) {
+            snapshots->slots[i] = slots[i];
+            snapshots->seqs[i] = 0;
+        }
+        snapshots->write = 0;
+        snapshots->ready = 1;
+        snapshots->read = 2;
+        snapshots->fresh = 0;
+        snapshots->next_seq = 1;
+        snapshots->consumed = 0;
+        snapshots->stopped = 0;
+        snapshots->mutex = al_create_mutex();
+        snapshots->cond = al_create_cond();
+    }
+
+    return snapshots;
+}
+
+
+void destroy_snapshots(SNAPSHOTS *snapshots)
+{
+    if (snapshots != NULL) {
+        al_destroy_cond(snapshots->cond);
+        al_destroy_mutex(snapshots->mutex);
+    }
+
+    free(snapshots);
+}
+
+
+void *write_snapshot(SNAPSHOTS *snapshots)
+{
+    return snapshots->slots[snapshots->write];
+}
+
+
+void publish_snapshot(SNAPSHOTS *snapshots)
+{
+    int swap;
+
+    al_lock_mutex(snapshots->mutex);
+
+    snapshots->seqs[snapshots->write] = snapshots->next_seq;
+    snapshots->next_seq++;
+
+  /**
+   * If the drawing thread hasn't picked up the last snapshot,
+   * it's simply replaced by this newer one.
+   */
+    swap = snapshots->ready;
+    snapshots->ready = snapshots->write;
+    snapshots->write = swap;
+    snapshots->fresh = 1;
+
+    al_signal_cond(snapshots->cond);
+    al_unlock_mutex(snapshots->mutex);
+}
+
+
+unsigned long snapshot_seq(SNAPSHOTS *snapshots)
+{
+    /* Only the updating thread changes this, so no lock is needed */
+    return snapshots->next_seq;
+}
+
+
+unsigned long consumed_snapshot(SNAPSHOTS *snapshots)
+{
+    unsigned long consumed;
+
+    al_lock_mutex(snapshots->mutex);
+    consumed = snapshots->consumed;
+    al_unlock_mutex(snapshots->mutex);
+
+    return consumed;
+}
+
+
+void *read_snapshot(SNAPSHOTS *snapshots)
+{
+    void *slot = NULL;
+    int swap;
+
+    al_lock_mutex(snapshots->mutex);
+
+    while (!snapshots->fresh && !snapshots->stopped) {
+        al_wait_cond(snapshots->cond, snapshots->mutex);
+    }
+
+    if (!snapshots->stopped) {
+        swap = snapshots->read;
+        snapshots->read = snapshots->ready;
+        snapshots->ready = swap;
+        snapshots->fresh = 0;
+        snapshots->consumed = snapshots->seqs[snapshots->read];
+        slot = snapshots->slots[snapshots->read];
+    }
+
+    al_unlock_mutex(snapshots->mutex);
+
+    return slot;
+}
+
+
+void stop_snapshots(SNAPSHOTS *snapshots)
+{
+    al_lock_mutex(snapshots->mutex);
+    snapshots->stopped = 1;
+    al_broadcast_cond(snapshots->cond);
+    al_unlock_mutex(snapshots->mutex);
+}
@@ -0,0 +1,72 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+
+/**
+ * A triple buffer for handing snapshots of the game from
+ * the thread that updates the game to the thread that draws it.
+ *
+ * The updating thread writes into one slot while the drawing
+ * thread reads from another, and the third slot holds the newest
+ * finished snapshot. Neither thread ever waits for the other
+ * to finish writing or drawing.
+ */
+#define NUM_SNAPSHOTS 3
+
+
+typedef struct SNAPSHOTS SNAPSHOTS;
+
+
+/**
+ * Create a snapshot buffer from three slots of memory.
+ * The slots are owned by the caller and must stay around
+ * until the buffer is destroyed.
+ */
+SNAPSHOTS *create_snapshots(void *slots[NUM_SNAPSHOTS]);
+
+/**
+ * Free the memory of the snapshot buffer. This will not
+ * free the slots.
+ */
+void destroy_snapshots(SNAPSHOTS *snapshots);
+
+/**
+ * Get the slot to write the next snapshot into.
+ * Only call this from the updating thread.
+ */
+void *write_snapshot(SNAPSHOTS *snapshots);
+
+/**
+ * Make the snapshot that was just written the newest one.
+ * Only call this from the updating thread.
+ */
+void publish_snapshot(SNAPSHOTS *snapshots);
+
+/**
+ * The sequence number that the snapshot being written will have.
+ * Sequence numbers start at 1 and go up by one with every
+ * published snapshot.
+ */
+unsigned long snapshot_seq(SNAPSHOTS *snapshots);
+
+/**
+ * The sequence number of the newest snapshot that has been
+ * read, or 0 if none have been read yet.
+ */
+unsigned long consumed_snapshot(SNAPSHOTS *snapshots);
+
+/**
+ * Wait for a snapshot that hasn't been read yet and return it.
+ * The snapshot stays valid until the next call.
+ * Returns NULL when the buffer has been stopped.
+ * Only call this from the drawing thread.
+ */
+void *read_snapshot(SNAPSHOTS *snapshots);
+
+/**
+ * Wake up the drawing thread and make read_snapshot return NULL.
+ */
+void stop_snapshots(SNAPSHOTS *snapshots);
+
+
+#endif
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_audio.h>
+
+#include "resource.h"
+#include "sound.h"
+
+
+#define MAX_VOICES 32
+
+
+typedef struct {
+    ALLEGRO_SAMPLE *sample;     /* NULL if nothing is loaded */
+    int priority;
+    int max_playing;
+    int queued;                 /* Is true if it was asked for this update */
+} SOUND_BANK_ENTRY;
+
+
+typedef struct {
+    ALLEGRO_SAMPLE_INSTANCE *instance;
+    int sound;                  /* The sound it last played */
+    int priority;
+} VOICE;
+
+
+static SOUND_BANK_ENTRY bank[MAX_SOUNDS];
+
+static VOICE voices[MAX_VOICES];
+static int num_voices = 0;
+
+static int sound_ready = 0;
+static int num_queued = 0;
+
+static ALLEGRO_AUDIO_STREAM *music = NULL;
+
+
+int init_sound(int voice_count)
+{
+    int i;
+
+    for (i = 0; i < MAX_SOUNDS; i++) {
+        bank[i].sample = NULL;
+        bank[i].queued = 0;
+    }
+
+    num_voices = 0;
+    num_queued = 0;
+    sound_ready = 0;
+
+    if (!al_install_audio() || !al_init_acodec_addon() || !al_reserve_samples(0)) {
+        fprintf(stderr, "SOUND: Failed to start audio, playing without sound.\n");
+        return 0;
+    }
+
+    if (voice_count > MAX_VOICES) {
+        voice_count = MAX_VOICES;
+    }
+
+  /**
+   * The voices are created without a sample, and
+   * given one when they're needed.
+   */
+    for (i = 0; i < voice_count; i++) {
+        voices[i].instance = al_create_sample_instance(NULL);
+
+        if (voices[i].instance == NULL ||
+            !al_attach_sample_instance_to_mixer(voices[i].instance, al_get_default_mixer())) {
+            al_destroy_sample_instance(voices[i].instance);
+            break;
+        }
+
+        voices[i].sound = -1;
+        voices[i].priority = 0;
+        num_voices++;
+    }
+
+    sound_ready = 1;
+
+    return 1;
+}
+
+
+void stop_sound()
+{
+    int i;
+
+    stop_music();
+
+    for (i = 0; i < num_voices; i++) {
+        al_destroy_sample_instance(voices[i].instance);
+    }
+
+    num_voices = 0;
+
+    for (i = 0; i < MAX_SOUNDS; i++) {
+        if (bank[i].sample != NULL) {
+            al_destroy_sample(bank[i].sample);
+            bank[i].sample = NULL;
+        }
+    }
+
+    if (sound_ready) {
+        al_uninstall_audio();
+    }
+
+    sound_ready = 0;
+}
+
+
+int load_sound(int sound, const char *filename, int priority, int max_playing)
+{
+    if (!sound_ready) {
+        return 0;
+    }
+
+    if (sound < 0 || sound >= MAX_SOUNDS) {
+        fprintf(stderr, "SOUND: Failed to load \"%s\".\n", filename);
+        fprintf(stderr, "SOUND: Try increasing MAX_SOUNDS.\n");
+        return 0;
+    }
+
+    if (bank[sound].sample != NULL) {
+        al_destroy_sample(bank[sound].sample);
+    }
+
+    bank[sound].sample = load_resource_sample(filename);
+    bank[sound].priority = priority;
+    bank[sound].max_playing = max_playing;
+    bank[sound].queued = 0;
+
+    if (bank[sound].sample == NULL) {
+        fprintf(stderr, "SOUND: Failed to load \"%s\".\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void play_sound(int sound)
+{
+    if (!sound_ready || sound < 0 || sound >= MAX_SOUNDS) {
+        return;
+    }
+
+    if (!bank[sound].queued) {
+        bank[sound].queued = 1;
+        num_queued++;
+    }
+}
+
+
+/**
+ * Internal function.
+ * Find a voice for a sound. Returns -1 if it shouldn't be played.
+ */
+static int find_voice(int sound)
+{
+    int playing = 0;
+    int lowest = -1;
+    int i;
+
+    for (i = 0; i < num_voices; i++) {
+        if (!al_get_sample_instance_playing(voices[i].instance)) {
+            continue;
+        }
+
+        if (voices[i].sound == sound) {
+            playing++;
+        }
+
+        if (lowest == -1 || voices[i].priority < voices[lowest].priority) {
+            lowest = i;
+        }
+    }
+
+    /* There are already enough copies of it playing */
+    if (playing >= bank[sound].max_playing) {
+        return -1;
+    }
+
+    for (i = 0; i < num_voices; i++) {
+        if (!al_get_sample_instance_playing(voices[i].instance)) {
+            return i;
+        }
+    }
+
+    /* Every voice is busy, so take one from a less important sound */
+    if (lowest != -1 && voices[lowest].priority < bank[sound].priority) {
+        return lowest;
+    }
+
+    return -1;
+}
+
+
+void flush_sounds()
+{
+    int best;
+    int voice;
+    int i;
+
+    while (num_queued > 0) {
+
+      /**
+       * Start the most important sounds first, so
+       * they get the voices if there aren't enough.
+       */
+        best = -1;
+
+        for (i = 0; i < MAX_SOUNDS; i++) {
+            if (bank[i].queued && (best == -1 || bank[i].priority > bank[best].priority)) {
+                best = i;
+            }
+        }
+
+        bank[best].queued = 0;
+        num_queued--;
+
+        if (bank[best].sample == NULL) {
+            continue;
+        }
+
+        voice = find_voice(best);
+
+        if (voice == -1) {
+            continue;
+        }
+
+        /* This stops whatever the voice was playing */
+        if (voices[voice].sound != best) {
+            al_set_sample(voices[voice].instance, bank[best].sample);
+            voices[voice].sound = best;
+        }
+
+        al_set_sample_instance_position(voices[voice].instance, 0);
+
+        voices[voice].priority = bank[best].priority;
+        al_play_sample_instance(voices[voice].instance);
+    }
+}
+
+
+int play_music(const char *filename, float gain)
+{
+    if (!sound_ready) {
+        return 0;
+    }
+
+    stop_music();
+
+    music = load_resource_audio_stream(filename, MUSIC_BUFFERS, MUSIC_BUFFER_SAMPLES);
+
+    if (music == NULL) {
+        fprintf(stderr, "SOUND: Playing without music.\n");
+        return 0;
+    }
+
+    al_set_audio_stream_playmode(music, ALLEGRO_PLAYMODE_LOOP);
+    al_set_audio_stream_gain(music, gain);
+
+    if (!al_attach_audio_stream_to_mixer(music, al_get_default_mixer())) {
+        fprintf(stderr, "SOUND: Failed to play \"%s\".\n", filename);
+        stop_music();
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void stop_music()
+{
+    if (music != NULL) {
+        al_destroy_audio_stream(music);
+        music = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+
+/**
+ * Sound effects. Every sound is loaded into a bank before the
+ * game starts, and played on a fixed set of voices, so playing
+ * a sound never loads or allocates anything.
+ *
+ * Sounds asked for during an update are queued, and started
+ * together when the update is done. A sound that's asked for
+ * more than once in the same update is only played once.
+ */
+
+
+#define MAX_SOUNDS 16
+#define DEFAULT_VOICES 8
+
+/**
+ * Music is streamed through a few small buffers, so it
+ * only takes MUSIC_BUFFERS * MUSIC_BUFFER_SAMPLES samples
+ * of memory no matter how long it is.
+ */
+#define MUSIC_BUFFERS 4
+#define MUSIC_BUFFER_SAMPLES 4096
+
+
+/**
+ * Start the audio system with a number of voices.
+ * Returns false if there's no audio. The game works
+ * without it, but no sounds are played.
+ */
+int init_sound(int voices);
+
+/**
+ * Stop all sounds and free the bank.
+ */
+void stop_sound();
+
+/**
+ * Load a sound into the bank with a number, from 0 to
+ * MAX_SOUNDS - 1. A sound with a higher priority takes the
+ * voice of one with a lower priority when every voice is busy.
+ * No more than max_playing copies of it play at the same time.
+ * Returns false on failure.
+ */
+int load_sound(int sound, const char *filename, int priority, int max_playing);
+
+/**
+ * Queue a sound to be played at the end of the update.
+ */
+void play_sound(int sound);
+
+/**
+ * Start playing the sounds that were queued.
+ * Call this once after every update.
+ */
+void flush_sounds();
+
+/**
+ * Start playing music over and over, stopping any music
+ * that's already playing. The music is decoded by the audio
+ * thread while it plays, so this never waits on it.
+ * Returns false if the music couldn't be played.
+ */
+int play_music(const char *filename, float gain);
+
+/**
+ * Stop the music.
+ */
+void stop_music();
+
+
+#endif
@@ -0,0 +1,210 @@
+#include <allegro5/allegro.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "archive.h"
+#include "level.h"
+#include "thumbs.h"
+
+
+#define HASH_BUFFER_SIZE 4096
+
+/* 32 bit FNV-1a */
+#define HASH_START 2166136261UL
+#define HASH_PRIME 16777619UL
+
+#define NUM_THUMB_COLORS 8
+
+
+/* The colors of the block ids, in the order the level lists them */
+static const unsigned char thumb_colors[NUM_THUMB_COLORS][3] = {
+    {240, 200, 40},
+    {220, 60, 60},
+    {60, 170, 70},
+    {70, 120, 220},
+    {240, 130, 30},
+    {150, 80, 200},
+    {40, 190, 190},
+    {200, 200, 200}
+};
+
+static const unsigned char thumb_background[3] = {30, 30, 40};
+static const unsigned char thumb_border[3] = {0, 0, 0};
+
+
+/**
+ * Internal function.
+ * Add some bytes to a hash.
+ */
+static unsigned long add_to_hash(unsigned long hash, const unsigned char *data, long size)
+{
+    long i;
+
+    for (i = 0; i < size; i++) {
+        hash = ((hash ^ data[i]) * HASH_PRIME) & 0xFFFFFFFFUL;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Internal function.
+ * Hash the contents of a level file, from the archive if
+ * it's open. Returns false if the file can't be read.
+ */
+static int hash_level_file(const char *filename, unsigned long *hash)
+{
+    unsigned char buffer[HASH_BUFFER_SIZE];
+    const void *data;
+    FILE *file;
+    long size;
+
+    *hash = HASH_START;
+
+    data = archive_data(filename, &size);
+
+    if (data != NULL) {
+        *hash = add_to_hash(*hash, data, size);
+        return 1;
+    }
+
+    file = fopen(filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "THUMBS: Failed to open \"%s\".\n", filename);
+        return 0;
+    }
+
+    while ((size = fread(buffer, 1, HASH_BUFFER_SIZE, file)) > 0) {
+        *hash = add_to_hash(*hash, buffer, size);
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+
+/**
+ * Internal function.
+ */
+static ALLEGRO_COLOR thumb_color(const unsigned char color[3])
+{
+    return al_map_rgb(color[0], color[1], color[2]);
+}
+
+
+/**
+ * Internal function.
+ * Draw a thumbnail of a level's map, with one pixel for each
+ * spot in the thumbnail. The whole map fits in the thumbnail
+ * without being stretched. The thumbnail is a memory bitmap,
+ * so this works on any thread.
+ */
+static ALLEGRO_BITMAP *draw_thumb(LEVEL *level)
+{
+    ALLEGRO_BITMAP *thumb;
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    LEVEL_CELL *cell;
+    float scale = 0;
+    int flags = al_get_new_bitmap_flags();
+    int left = 0;
+    int top = 0;
+    int w = 0;
+    int h = 0;
+    int x;
+    int y;
+
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    thumb = al_create_bitmap(THUMB_W, THUMB_H);
+    al_set_new_bitmap_flags(flags);
+
+    if (thumb == NULL) {
+        return NULL;
+    }
+
+    if (level->cells != NULL && level->width > 0 && level->height > 0) {
+        scale = THUMB_W / (float)level->width;
+
+        if (THUMB_H / (float)level->height < scale) {
+            scale = THUMB_H / (float)level->height;
+        }
+
+        w = level->width * scale;
+        h = level->height * scale;
+        left = (THUMB_W - w) / 2;
+        top = (THUMB_H - h) / 2;
+    }
+
+    al_set_target_bitmap(thumb);
+    al_lock_bitmap(thumb, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_WRITEONLY);
+
+    for (y = 0; y < THUMB_H; y++) {
+        for (x = 0; x < THUMB_W; x++) {
+            if (x < left || x >= left + w || y < top || y >= top + h) {
+                al_put_pixel(x, y, thumb_color(thumb_border));
+                continue;
+            }
+
+            cell = &level->cells[(int)((y - top) / scale) * level->width + (int)((x - left) / scale)];
+
+            if (cell->block == NO_LEVEL_BLOCK) {
+                al_put_pixel(x, y, thumb_color(thumb_background));
+            } else {
+                al_put_pixel(x, y, thumb_color(thumb_colors[cell->block % NUM_THUMB_COLORS]));
+            }
+        }
+    }
+
+    al_unlock_bitmap(thumb);
+    al_set_target_bitmap(target);
+
+    return thumb;
+}
+
+
+int cache_level_thumb(const char *filename, char *dest, int size)
+{
+    ALLEGRO_BITMAP *thumb;
+    LEVEL *level;
+    char name[THUMB_FILENAME_SIZE];
+    unsigned long hash;
+    int saved;
+
+    if (!hash_level_file(filename, &hash)) {
+        return 0;
+    }
+
+    sprintf(name, "%s%08lx.bmp", THUMB_CACHE_DIR, hash);
+    strncpy(dest, name, size - 1);
+    dest[size - 1] = '\0';
+
+    if (al_filename_exists(name)) {
+        return 1;
+    }
+
+    level = load_level(filename);
+
+    if (level == NULL) {
+        return 0;
+    }
+
+    thumb = draw_thumb(level);
+    destroy_level(level);
+
+    if (thumb == NULL) {
+        fprintf(stderr, "THUMBS: Failed to draw a thumbnail of \"%s\".\n", filename);
+        return 0;
+    }
+
+    al_make_directory(THUMB_CACHE_DIR);
+    saved = al_save_bitmap(name, thumb);
+    al_destroy_bitmap(thumb);
+
+    if (!saved) {
+        fprintf(stderr, "THUMBS: Failed to save \"%s\".\n", name);
+    }
+
+    return saved;
+}
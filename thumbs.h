@@ -0,0 +1,30 @@
+#ifndef THUMBS_H
+#define THUMBS_H
+
+
+/**
+ * Thumbnails of levels, for picking a level to play. A thumbnail
+ * is drawn from the level's map once, and saved in a cache
+ * directory named after a hash of the level file, so it's only
+ * drawn again when the level changes.
+ */
+
+
+#define THUMB_W 128
+#define THUMB_H 96
+
+#define THUMB_CACHE_DIR "thumbs/"
+#define THUMB_FILENAME_SIZE 256
+
+
+/**
+ * Make sure there's a thumbnail of a level in the cache, drawing
+ * it from the level if there isn't one yet. Sets dest to the
+ * filename of the thumbnail, to load with the resource library
+ * (see resource.h). Can be called by any thread.
+ * Returns false on failure.
+ */
+int cache_level_thumb(const char *filename, char *dest, int size);
+
+
+#endif
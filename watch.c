@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+
+#define MAX_WATCHES 8
+#define MAX_WATCH_PATH_SIZE 256
+
+/* Room for a few events at a time */
+#define WATCH_BUFFER_SIZE 4096
+
+
+static int watch_fd = -1;
+
+static char watch_paths[MAX_WATCHES][MAX_WATCH_PATH_SIZE];
+static int watch_ids[MAX_WATCHES];
+static int num_watches = 0;
+
+/* Events that have been read but not handed out yet */
+static union {
+    struct inotify_event event; /* Keeps the events lined up in memory */
+    char bytes[WATCH_BUFFER_SIZE];
+} buffer;
+static int buffer_pos = 0;
+static int buffer_size = 0;
+
+
+int init_watch()
+{
+    watch_fd = inotify_init1(IN_NONBLOCK);
+
+    if (watch_fd < 0) {
+        fprintf(stderr, "WATCH: Failed to start watching files.\n");
+        return 0;
+    }
+
+    num_watches = 0;
+    buffer_pos = 0;
+    buffer_size = 0;
+
+    return 1;
+}
+
+
+void stop_watch()
+{
+    if (watch_fd >= 0) {
+        close(watch_fd);
+    }
+
+    watch_fd = -1;
+    num_watches = 0;
+}
+
+
+int watch_directory(const char *path)
+{
+    int id;
+
+    if (watch_fd < 0) {
+        return 0;
+    }
+
+    if (num_watches >= MAX_WATCHES) {
+        fprintf(stderr, "WATCH: Failed to watch \"%s\".\n", path);
+        fprintf(stderr, "WATCH: Try increasing MAX_WATCHES.\n");
+        return 0;
+    }
+
+  /**
+   * Editors either write the file or save a new copy and
+   * move it over the old one, so watch for both.
+   */
+    id = inotify_add_watch(watch_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    if (id < 0) {
+        fprintf(stderr, "WATCH: Failed to watch \"%s\".\n", path);
+        return 0;
+    }
+
+    strncpy(watch_paths[num_watches], path, MAX_WATCH_PATH_SIZE - 1);
+    watch_paths[num_watches][MAX_WATCH_PATH_SIZE - 1] = '\0';
+    watch_ids[num_watches] = id;
+    num_watches++;
+
+    return 1;
+}
+
+
+int next_changed_file(char *filename, int size)
+{
+    struct inotify_event *event;
+    ssize_t length;
+    int i;
+
+    if (watch_fd < 0) {
+        return 0;
+    }
+
+    while (1) {
+
+        /* Read more events */
+        if (buffer_pos >= buffer_size) {
+            length = read(watch_fd, buffer.bytes, WATCH_BUFFER_SIZE);
+
+            if (length <= 0) {
+                return 0;
+            }
+
+            buffer_pos = 0;
+            buffer_size = length;
+        }
+
+        event = (struct inotify_event *)(buffer.bytes + buffer_pos);
+        buffer_pos += sizeof(struct inotify_event) + event->len;
+
+        if (event->len == 0) {
+            continue;
+        }
+
+        for (i = 0; i < num_watches; i++) {
+            if (watch_ids[i] == event->wd) {
+                strncpy(filename, watch_paths[i], size - 1);
+                filename[size - 1] = '\0';
+                strncat(filename, event->name, size - strlen(filename) - 1);
+                return 1;
+            }
+        }
+    }
+}
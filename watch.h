@@ -0,0 +1,37 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+
+/**
+ * Watch directories for files that change, so they can be
+ * loaded again while the game is running. This uses inotify,
+ * so it only works on Linux.
+ */
+
+
+/**
+ * Start watching. Returns false if files can't be watched.
+ */
+int init_watch();
+
+/**
+ * Stop watching every directory.
+ */
+void stop_watch();
+
+/**
+ * Watch the files in a directory, such as "images/".
+ * The path should end with a slash.
+ * Returns false on failure.
+ */
+int watch_directory(const char *path);
+
+/**
+ * Get the name of the next file that changed, such as
+ * "images/bee1.bmp". This never waits.
+ * Returns false if no more files have changed.
+ */
+int next_changed_file(char *filename, int size);
+
+
+#endif
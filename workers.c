@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <allegro5/allegro.h>
+
+#include "workers.h"
+
+
+/* Jobs that can be waiting at one time */
+#define MAX_JOBS 256
+
+
+typedef struct JOB {
+    void (*run)(void *data);    /* NULL if it was taken out of the ring early */
+    void *data;
+    JOB_GROUP *group;           /* NULL if it isn't in a group */
+} JOB;
+
+
+static ALLEGRO_THREAD *workers[MAX_WORKERS];
+static int num_workers = 0;
+
+/* A ring of jobs waiting to be run */
+static JOB jobs[MAX_JOBS];
+static int first_job = 0;
+static int num_jobs = 0;
+
+static int busy_jobs = 0;       /* Jobs being run right now */
+static int stopping = 0;
+
+static ALLEGRO_MUTEX *mutex = NULL;
+static ALLEGRO_COND *job_added = NULL;
+static ALLEGRO_COND *job_done = NULL;
+
+
+/**
+ * Internal function.
+ * Drop the jobs at the front of the ring that were already
+ * taken out of it, with the lock held.
+ */
+static void drop_taken_jobs()
+{
+    while (num_jobs > 0 && jobs[first_job].run == NULL) {
+        first_job = (first_job + 1) % MAX_JOBS;
+        num_jobs--;
+    }
+
+    /* Somebody might be waiting for room in the ring */
+    al_broadcast_cond(job_done);
+}
+
+
+/**
+ * Internal function.
+ * Take a job out of the ring, with the lock held.
+ */
+static JOB take_job(int i)
+{
+    JOB job = jobs[i];
+
+    jobs[i].run = NULL;
+    busy_jobs++;
+
+    drop_taken_jobs();
+
+    return job;
+}
+
+
+/**
+ * Internal function.
+ * Run a job, with the lock held.
+ */
+static void run_job(JOB job)
+{
+    al_unlock_mutex(mutex);
+    job.run(job.data);
+    al_lock_mutex(mutex);
+
+    busy_jobs--;
+
+    if (job.group != NULL) {
+        job.group->pending--;
+    }
+
+    al_broadcast_cond(job_done);
+}
+
+
+/**
+ * Internal function.
+ * Find a job of a group that hasn't started, with the lock held.
+ * Returns -1 if there isn't one.
+ */
+static int find_group_job(JOB_GROUP *group)
+{
+    int i;
+
+    for (i = 0; i < num_jobs; i++) {
+        if (jobs[(first_job + i) % MAX_JOBS].run != NULL &&
+            jobs[(first_job + i) % MAX_JOBS].group == group) {
+            return (first_job + i) % MAX_JOBS;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * Internal function.
+ * The main loop of a worker thread.
+ */
+static void *work(ALLEGRO_THREAD *thread, void *arg)
+{
+    al_lock_mutex(mutex);
+
+    while (1) {
+        while (num_jobs == 0 && !stopping) {
+            al_wait_cond(job_added, mutex);
+        }
+
+        if (num_jobs == 0) {
+            break;
+        }
+
+        run_job(take_job(first_job));
+    }
+
+    al_unlock_mutex(mutex);
+
+    return NULL;
+}
+
+
+void init_workers(int count)
+{
+    int i;
+
+    if (count > MAX_WORKERS) {
+        count = MAX_WORKERS;
+    }
+
+    first_job = 0;
+    num_jobs = 0;
+    busy_jobs = 0;
+    stopping = 0;
+
+    mutex = al_create_mutex();
+    job_added = al_create_cond();
+    job_done = al_create_cond();
+
+    for (num_workers = 0, i = 0; i < count; i++) {
+        workers[num_workers] = al_create_thread(work, NULL);
+
+        if (workers[num_workers] == NULL) {
+            fprintf(stderr, "WORKERS: Failed to create a worker thread.\n");
+            break;
+        }
+
+        al_start_thread(workers[num_workers]);
+        num_workers++;
+    }
+}
+
+
+void stop_workers()
+{
+    int i;
+
+    al_lock_mutex(mutex);
+    stopping = 1;
+    al_broadcast_cond(job_added);
+    al_unlock_mutex(mutex);
+
+    for (i = 0; i < num_workers; i++) {
+        al_join_thread(workers[i], NULL);
+        al_destroy_thread(workers[i]);
+        workers[i] = NULL;
+    }
+
+    num_workers = 0;
+
+    al_destroy_cond(job_done);
+    al_destroy_cond(job_added);
+    al_destroy_mutex(mutex);
+    job_done = NULL;
+    job_added = NULL;
+    mutex = NULL;
+}
+
+
+void add_job(void (*run)(void *data), void *data)
+{
+    add_group_job(NULL, run, data);
+}
+
+
+int add_urgent_job(void (*run)(void *data), void *data)
+{
+    if (num_workers == 0) {
+        return 0;
+    }
+
+    al_lock_mutex(mutex);
+
+    if (num_jobs == MAX_JOBS) {
+        al_unlock_mutex(mutex);
+        return 0;
+    }
+
+    first_job = (first_job + MAX_JOBS - 1) % MAX_JOBS;
+    num_jobs++;
+
+    jobs[first_job].run = run;
+    jobs[first_job].data = data;
+    jobs[first_job].group = NULL;
+
+    al_signal_cond(job_added);
+    al_unlock_mutex(mutex);
+
+    return 1;
+}
+
+
+void init_job_group(JOB_GROUP *group)
+{
+    group->pending = 0;
+}
+
+
+void add_group_job(JOB_GROUP *group, void (*run)(void *data), void *data)
+{
+    JOB job;
+
+    job.run = run;
+    job.data = data;
+    job.group = group;
+
+    /* There's nobody to hand it to */
+    if (num_workers == 0) {
+        job.run(job.data);
+        return;
+    }
+
+    al_lock_mutex(mutex);
+
+    while (num_jobs == MAX_JOBS) {
+        al_wait_cond(job_done, mutex);
+    }
+
+    jobs[(first_job + num_jobs) % MAX_JOBS] = job;
+    num_jobs++;
+
+    if (group != NULL) {
+        group->pending++;
+    }
+
+    al_signal_cond(job_added);
+    al_unlock_mutex(mutex);
+}
+
+
+void wait_for_jobs()
+{
+    al_lock_mutex(mutex);
+
+    while (num_jobs > 0 || busy_jobs > 0) {
+        if (num_jobs > 0) {
+            run_job(take_job(first_job));
+        } else {
+            al_wait_cond(job_done, mutex);
+        }
+    }
+
+    al_unlock_mutex(mutex);
+}
+
+
+void wait_for_job_group(JOB_GROUP *group)
+{
+    int i;
+
+    /* The jobs were run when they were added */
+    if (num_workers == 0) {
+        return;
+    }
+
+    al_lock_mutex(mutex);
+
+    while (group->pending > 0) {
+        i = find_group_job(group);
+
+        if (i >= 0) {
+            run_job(take_job(i));
+        } else {
+            al_wait_cond(job_done, mutex);
+        }
+    }
+
+    al_unlock_mutex(mutex);
+}
+
+
+int cancel_job_group(JOB_GROUP *group)
+{
+    int cancelled = 0;
+    int i;
+
+    if (num_workers == 0) {
+        return 0;
+    }
+
+    al_lock_mutex(mutex);
+
+    while ((i = find_group_job(group)) >= 0) {
+        jobs[i].run = NULL;
+        group->pending--;
+        cancelled++;
+    }
+
+    drop_taken_jobs();
+
+    while (group->pending > 0) {
+        al_wait_cond(job_done, mutex);
+    }
+
+    al_unlock_mutex(mutex);
+
+    return cancelled;
+}
@@ -0,0 +1,88 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+
+/**
+ * A pool of worker threads for doing slow jobs, like
+ * decoding images, in parallel.
+ */
+#define MAX_WORKERS 8
+
+
+/**
+ * Jobs that can be waited for together, without waiting for
+ * anybody else's jobs. Set it up with init_job_group before
+ * adding jobs to it.
+ */
+typedef struct JOB_GROUP {
+    int pending;                /* Jobs that were added but haven't finished */
+} JOB_GROUP;
+
+
+/**
+ * Start the worker threads. If the number of workers is 0,
+ * jobs are run right away by the thread that adds them.
+ */
+void init_workers(int num_workers);
+
+/**
+ * Finish the jobs that are waiting and stop the worker threads.
+ */
+void stop_workers();
+
+/**
+ * Add a job for a worker to run. The job function is called
+ * with the data on one of the worker threads. If too many jobs
+ * are waiting, this waits until there is room.
+ *
+ * Don't add jobs from inside a job.
+ */
+void add_job(void (*job)(void *data), void *data);
+
+/**
+ * Add a job that should start before the others, at the front
+ * of the queue. This never waits: if there's no room, or no
+ * workers, the job isn't added and this returns false, so the
+ * caller can run it itself.
+ */
+int add_urgent_job(void (*job)(void *data), void *data);
+
+/**
+ * Start a job group with no jobs in it.
+ */
+void init_job_group(JOB_GROUP *group);
+
+/**
+ * Add a job that belongs to a group, just like add_job.
+ */
+void add_group_job(JOB_GROUP *group, void (*job)(void *data), void *data);
+
+/**
+ * Wait until every job in a group is done. The thread that
+ * waits runs the group's jobs that haven't started yet, but
+ * not anybody else's.
+ *
+ * Don't call this from inside a job.
+ */
+void wait_for_job_group(JOB_GROUP *group);
+
+/**
+ * Take the jobs of a group that haven't started out of the
+ * queue, and wait for the ones that are running. The jobs that
+ * were taken out are never run, so their data is still yours.
+ * Returns the number of jobs that were taken out.
+ *
+ * Don't call this from inside a job.
+ */
+int cancel_job_group(JOB_GROUP *group);
+
+/**
+ * Wait until every job is done. The thread that waits
+ * helps out by running jobs too.
+ *
+ * Don't call this from inside a job.
+ */
+void wait_for_jobs();
+
+
+#endif